@@ -37,13 +37,15 @@ using chatserver::ChatMessage;
 /** Method to create a chat message
  * @param message: message to send
  * @param user: user sending the message
+ * @param userId: id of the user sending the message
  * @return ChatMessage: created chat message
  */
-ChatMessage createChatMessage(std::string message, std::string user)
+ChatMessage createChatMessage(std::string message, std::string user, uint32_t userId)
 {
     ChatMessage chatMessage;
     chatMessage.set_messages(message);
     chatMessage.set_user(user);
+    chatMessage.set_userid(userId);
     return chatMessage;
 }
 
@@ -52,6 +54,7 @@ ChatMessage createChatMessage(std::string message, std::string user)
  */
 ChatServerClient::ChatServerClient(std::shared_ptr<Channel> channel)
                                  : _stub(ChatServer::NewStub(channel))
+                                 , _userId(0)
                                  , _rpcInProgress(0)
 {
     _signalSender = std::make_shared<SignalSender>();
@@ -84,6 +87,7 @@ void ChatServerClient::LogOut()
 
     // set user
     logOutRequest.set_user(_user);
+    logOutRequest.set_userid(_userId);
     std::unique_ptr<ClientAsyncResponseReader<LogOutReply>>
     rpc(_stub->AsyncLogOut(&context, logOutRequest, &cq));
     rpc->Finish(&logOutReply, &status, (void*)1);
@@ -112,6 +116,7 @@ void ChatServerClient::ReceiveMessage()
 
     // Set current user to get messages for
     request.set_user(_user);
+    request.set_userid(_userId);
 
     ClientContext context;
     // Start server streaming RPC
@@ -185,6 +190,8 @@ void ChatServerClient::SendMessage()
     {
         _mainWindow->appendMessage("Now sending messages");
         std::string message;
+        // Lets the server find the recipient without looking the name up
+        uint32_t recipientId = reply.recipientid();
 
         // Will break when some sort of quit signal comes from _mainWindow
         while(true)
@@ -193,7 +200,9 @@ void ChatServerClient::SendMessage()
                     
             // Set request parameters
             request.set_user(_user);
+            request.set_userid(_userId);
             request.set_recipient(recipient);
+            request.set_recipientid(recipientId);
             request.set_messages(message);
             request.set_requeststate(chatserver::SendMessageRequest::PROCESSING);                     
 
@@ -202,7 +211,19 @@ void ChatServerClient::SendMessage()
             {
                 stream->Write(request);
                 stream->Read(&reply);
-                _mainWindow->appendMessage("Message sent");
+
+                // Recipient was evicted since it was looked up, its id is no good anymore
+                if(reply.recipientstate() == chatserver::SendMessageReply::NO_EXIST)
+                {
+                    _mainWindow->appendMessage("The user does not exist anymore");
+                    stream->WritesDone();
+                    break;
+                }
+                // Server turns the message away when the recipient's mailbox is full
+                if(reply.confirmation() == SEND_MESSAGE_MAILBOX_FULL)
+                    _mainWindow->appendMessage("Mailbox of the user is full, message not sent");
+                else
+                    _mainWindow->appendMessage("Message sent");
             }
             else
             {
@@ -276,7 +297,7 @@ void ChatServerClient::Chat()
         && !(_mainWindow->getAppQuitRequest()))
         {
             _mainWindow->appendMessage("[" + _user + "]: " + message);
-            stream->Write(createChatMessage(message, _user));
+            stream->Write(createChatMessage(message, _user, _userId));
         }
         else
         {
@@ -393,6 +414,7 @@ bool ChatServerClient::LogIn()
         _logInWindow->setLabelText("Something went wrong logging in");
 
     _user = user;
+    _userId = reply.userid();
     return success;
 }
 
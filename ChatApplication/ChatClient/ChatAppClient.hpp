@@ -60,6 +60,7 @@ class ChatServerClient
 
         CompletionQueue cq_;
         std::string _user;
+        uint32_t _userId; // Id the server gave at log in, 0 if it gave none
         bool _rpcInProgress;
 };
 
@@ -0,0 +1,981 @@
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "chatserver.grpc.pb.h"
+#include "CallbackServer.hpp"
+#include "ChatServerGlobal.h"
+#include "ListReplyCache.hpp"
+
+using chatserver::LogInRequest;
+using chatserver::LogInReply;
+using chatserver::LogOutRequest;
+using chatserver::LogOutReply;
+using chatserver::SendMessageRequest;
+using chatserver::SendMessageReply;
+using chatserver::ReceiveMessageRequest;
+using chatserver::ReceiveMessageReply;
+using chatserver::ChatMessage;
+using chatserver::ListUsersRequest;
+using chatserver::ListUsersReply;
+using chatserver::WatchPresenceRequest;
+using chatserver::PresenceUpdate;
+
+class ChatReactor;
+
+/** The ChatServer service on the callback API. Every method hands its rpc to a
+ * reactor working on the shared ChatCore, and the service keeps the reactors
+ * taking part in the chat.
+ */
+class CallbackChatService final : public chatserver::ChatServer::WithRawCallbackMethod_List<chatserver::ChatServer::CallbackService>
+{
+    public:
+
+        explicit CallbackChatService(ChatCore& core);
+
+        grpc::ServerBidiReactor<LogInRequest, LogInReply>* LogIn(grpc::CallbackServerContext* context) override;
+        grpc::ServerUnaryReactor* LogOut(grpc::CallbackServerContext* context, const LogOutRequest* request, LogOutReply* reply) override;
+        grpc::ServerBidiReactor<SendMessageRequest, SendMessageReply>* SendMessage(grpc::CallbackServerContext* context) override;
+        grpc::ServerWriteReactor<ReceiveMessageReply>* ReceiveMessage(grpc::CallbackServerContext* context, const ReceiveMessageRequest* request) override;
+        grpc::ServerUnaryReactor* List(grpc::CallbackServerContext* context, const grpc::ByteBuffer* request, grpc::ByteBuffer* reply) override;
+        grpc::ServerUnaryReactor* ListUsers(grpc::CallbackServerContext* context, const ListUsersRequest* request, ListUsersReply* reply) override;
+        grpc::ServerWriteReactor<PresenceUpdate>* WatchPresence(grpc::CallbackServerContext* context, const WatchPresenceRequest* request) override;
+        grpc::ServerBidiReactor<ChatMessage, ChatMessage>* Chat(grpc::CallbackServerContext* context) override;
+
+        void joinChat(ChatReactor* reactor);
+        void leaveChat(ChatReactor* reactor);
+        void broadcast(ChatReactor* sender, const ChatMessage& note);
+
+        void reactorDone();
+        void printStats(std::ostream& out);
+
+    private:
+
+        ChatCore& mCore;
+        ListReplyCache mListCache;
+        std::atomic<uint64_t> mCalls[RPC_METHOD_COUNT]; // Rpcs of each method started so far
+        std::atomic<int> mActiveReactors; // Streaming rpcs not done yet
+        std::atomic<uint64_t> mBroadcasts;
+
+        std::mutex mChatMutex; // Guards mChatReactors
+        std::unordered_set<ChatReactor*> mChatReactors;
+};
+
+/** Reactor of a bidirectional rpc answering every request with one reply, used by
+ * LogIn and SendMessage. It reads a request, writes its reply and only then reads
+ * the next one, so at most one read or write is in flight. The rpc is finished
+ * once the client is done sending.
+ */
+template<typename RequestType, typename ResponseType>
+class ReplyReactor final : public grpc::ServerBidiReactor<RequestType, ResponseType>
+{
+    public:
+
+        using Answer = std::function<void(const RequestType&, ResponseType&)>;
+
+        /** ReplyReactor Constructor, starts reading right away
+         * @param CallbackChatService* service: service to report to once done
+         * @param Answer answer: fills the reply to a request
+         */
+        ReplyReactor(CallbackChatService* service, Answer answer): mService(service)
+                                                                 , mAnswer(std::move(answer))
+        {
+            this->StartRead(&mRequest);
+        }
+
+        void OnReadDone(bool ok) override
+        {
+            // The client is done sending or the rpc is gone
+            if (!ok)
+            {
+                this->Finish(grpc::Status::OK);
+                return;
+            }
+
+            mReply.Clear();
+            mAnswer(mRequest, mReply);
+            this->StartWrite(&mReply);
+        }
+
+        void OnWriteDone(bool ok) override
+        {
+            // A failed write means the rpc is gone, the read then fails and finishes it
+            this->StartRead(&mRequest);
+        }
+
+        void OnDone() override
+        {
+            mService->reactorDone();
+            delete this;
+        }
+
+    private:
+
+        CallbackChatService* mService;
+        Answer mAnswer;
+        RequestType mRequest;
+        ResponseType mReply;
+};
+
+/** Reactor of a ReceiveMessage rpc, empties the user's mailbox one message per
+ * write, taking them out a batch at a time. The last write carries the EMPTY
+ * state and finishes the rpc along with it, a mailbox that is empty from the
+ * start finishes it without any write.
+ */
+class MailboxReactor final : public grpc::ServerWriteReactor<ReceiveMessageReply>
+{
+    public:
+
+        /** MailboxReactor Constructor, starts writing right away
+         * @param CallbackChatService* service: service to report to once done
+         * @param ChatCore& core: core holding the mailbox
+         * @param uint32_t userId: id of the owner of the mailbox, 0 if the client only sent the name
+         * @param const std::string& user: name of the owner of the mailbox
+         */
+        MailboxReactor(CallbackChatService* service, ChatCore& core, uint32_t userId, const std::string& user): mService(service)
+                                                                                                              , mCore(core)
+                                                                                                              , mUserId(userId)
+                                                                                                              , mUser(user)
+                                                                                                              , mNext(0)
+                                                                                                              , mWrote(false)
+        {
+            writeNext();
+        }
+
+        void OnWriteDone(bool ok) override
+        {
+            if (!ok)
+            {
+                Finish(grpc::Status::CANCELLED);
+                return;
+            }
+            writeNext();
+        }
+
+        void OnDone() override
+        {
+            mService->reactorDone();
+            delete this;
+        }
+
+    private:
+
+        /** Write the next message of the mailbox, or finish once there is none left
+         */
+        void writeNext()
+        {
+            if (mNext == mMessages.size())
+            {
+                mCore.takeMessages(mUserId, mUser, mMessages, Mailbox::DRAIN_BATCH);
+                mNext = 0;
+            }
+
+            mReply.Clear();
+            if (mNext < mMessages.size())
+            {
+                mReply.set_queuestate(chatserver::ReceiveMessageReply::NON_EMPTY);
+                mReply.set_messages(mMessages[mNext++]);
+                mWrote = true;
+                StartWrite(&mReply);
+            }
+            else if (mWrote)
+            {
+                mReply.set_queuestate(chatserver::ReceiveMessageReply::EMPTY);
+                mReply.set_messages(RECEIVE_MESSAGE_EMPTY);
+                StartWriteAndFinish(&mReply, grpc::WriteOptions(), grpc::Status::OK);
+            }
+            else
+            {
+                Finish(grpc::Status::OK);
+            }
+        }
+
+        CallbackChatService* mService;
+        ChatCore& mCore;
+        uint32_t mUserId;
+        std::string mUser;
+        std::vector<std::string> mMessages; // Batch taken out of the mailbox
+        size_t mNext;                       // Next message of the batch to write
+        ReceiveMessageReply mReply;
+        bool mWrote; // At least one message was written
+};
+
+/** Reactor of a subscribed ReceiveMessage rpc. The stream stays open and the
+ * senders wake it up through its subscriber, it then takes a batch out of the
+ * mailbox and writes it one message per write. The next batch is only taken
+ * once the last one is written, so the messages a slow client has not read yet
+ * stay in the mailbox under its overflow policy. The rpc is finished once it
+ * is cancelled, or once a newer subscription of the user replaced it.
+ * gRPC may run reactions of the rpc inline from StartWrite() or Finish(), so
+ * these are never called with mMutex held. The subscriber keeps a reference
+ * on the reactor, the last reference deletes it.
+ */
+class InboxReactor final : public grpc::ServerWriteReactor<ReceiveMessageReply>
+{
+    public:
+
+        /** InboxReactor Constructor, subscribes to the mailbox and writes what is in it already
+         * @param CallbackChatService* service: service to report to once done
+         * @param ChatCore& core: core holding the mailbox
+         * @param uint32_t userId: id of the owner of the mailbox, 0 if the client only sent the name
+         * @param const std::string& user: name of the owner of the mailbox
+         */
+        InboxReactor(CallbackChatService* service, ChatCore& core, uint32_t userId, const std::string& user): mService(service)
+                                                                                                            , mCore(core)
+                                                                                                            , mUserId(userId)
+                                                                                                            , mUser(user)
+                                                                                                            , mReferences(1)
+                                                                                                            , mSubscriber(std::make_shared<Subscriber>(this))
+                                                                                                            , mNext(0)
+                                                                                                            , mWriting(false)
+                                                                                                            , mCancelled(false)
+                                                                                                            , mFinished(false)
+        {
+            if (mCore.subscribe(mUserId, mUser, mSubscriber))
+            {
+                pump();
+                return;
+            }
+
+            // No such user, there is nothing to wait for
+            mFinished = true;
+            Finish(grpc::Status::OK);
+        }
+
+        void OnWriteDone(bool ok) override
+        {
+            bool more = false;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                // The rpc is gone, nothing more can be written
+                if (!ok)
+                {
+                    mCancelled = true;
+                    mMessages.clear();
+                }
+                else if (mNext < mMessages.size())
+                {
+                    mReply.set_messages(std::move(mMessages[mNext++]));
+                    more = true;
+                }
+
+                if (!more)
+                    mWriting = false;
+            }
+
+            if (more)
+                StartWrite(&mReply);
+            else
+                pump();
+        }
+
+        void OnCancel() override
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mCancelled = true;
+            }
+            pump();
+        }
+
+        void OnDone() override
+        {
+            mSubscriber->close();
+            mCore.unsubscribe(mUserId, mUser, mSubscriber.get());
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mSubscriber.reset();
+            }
+            mService->reactorDone();
+            release();
+        }
+
+    private:
+
+        // What the user's node holds, wakes the reactor up as long as it is around
+        class Subscriber final : public MailboxSubscriber
+        {
+            public:
+
+                explicit Subscriber(InboxReactor* reactor): mReactor(reactor)
+                {
+                    mReactor->mReferences.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                ~Subscriber()
+                {
+                    mReactor->release();
+                }
+
+                void notify() override
+                {
+                    mReactor->pump();
+                }
+
+            private:
+
+                InboxReactor* mReactor;
+        };
+
+        /** Drop a reference, the last one deletes the reactor
+         */
+        void release()
+        {
+            if (mReferences.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete this;
+        }
+
+        /** Write the next batch of the mailbox unless a write is in flight, or
+         * finish the rpc once it is cancelled or replaced, only once
+         */
+        void pump()
+        {
+            grpc::Status status;
+            bool write = false;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (mWriting || mFinished)
+                    return;
+
+                if (mCancelled || mSubscriber->closed())
+                {
+                    mFinished = true;
+                    status = mCancelled ? grpc::Status::CANCELLED : grpc::Status::OK;
+                }
+                else
+                {
+                    // Messages queued from now on wake the reactor again
+                    if (!mCore.takeMessages(mUserId, mUser, mMessages, Mailbox::DRAIN_BATCH))
+                        return;
+
+                    mReply.set_queuestate(chatserver::ReceiveMessageReply::NON_EMPTY);
+                    mReply.set_messages(std::move(mMessages[0]));
+                    mNext = 1;
+                    mWriting = true;
+                    write = true;
+                }
+            }
+
+            if (write)
+                StartWrite(&mReply);
+            else
+                Finish(status);
+        }
+
+        CallbackChatService* mService;
+        ChatCore& mCore;
+        uint32_t mUserId;
+        std::string mUser;
+        std::atomic<int> mReferences; // gRPC's and the subscriber's
+        std::shared_ptr<Subscriber> mSubscriber; // Reset once the rpc is done
+
+        std::mutex mMutex; // Guards the members below
+        std::vector<std::string> mMessages; // Batch taken out of the mailbox
+        size_t mNext;                       // Next message of the batch to write
+        ReceiveMessageReply mReply;
+        bool mWriting;
+        bool mCancelled;
+        bool mFinished; // Finish() was called, nothing can be written anymore
+};
+
+/** Reactor of a Chat rpc. Every note the client sends is broadcast to the other
+ * reactors on the chat, which queue it in their outbox and write it once the
+ * write in flight is done. The rpc is finished once the client is done sending
+ * and the outbox is written out.
+ * gRPC may run reactions of the rpc inline from StartWrite() or Finish(), so
+ * these are never called with mMutex held. The chat keeps a reference on the
+ * reactors it broadcasts to, the last reference deletes it.
+ */
+class ChatReactor final : public grpc::ServerBidiReactor<ChatMessage, ChatMessage>
+{
+    public:
+
+        /** ChatReactor Constructor, joins the chat and starts reading
+         * @param CallbackChatService* service: service holding the chat
+         */
+        explicit ChatReactor(CallbackChatService* service): mService(service)
+                                                          , mReferences(1)
+                                                          , mWriting(false)
+                                                          , mClientDone(false)
+                                                          , mFinished(false)
+        {
+            mService->joinChat(this);
+            StartRead(&mNote);
+        }
+
+        /** Queue a note from another client, writing it right away if no write is in flight
+         * @param const ChatMessage& note: note to send
+         */
+        void deliver(const ChatMessage& note)
+        {
+            const ChatMessage* write = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (mFinished)
+                    return;
+
+                mOutbox.push_back(note);
+                if (!mWriting)
+                {
+                    mWriting = true;
+                    write = &mOutbox.front();
+                }
+            }
+            // A deque keeps its elements in place when growing, the note stays valid until written
+            if (write)
+                StartWrite(write);
+        }
+
+        void OnReadDone(bool ok) override
+        {
+            if (ok)
+            {
+                if (mNote.messages() != DONE)
+                    mService->broadcast(this, mNote);
+                StartRead(&mNote);
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mClientDone = true;
+            }
+            finishIfDone();
+        }
+
+        void OnWriteDone(bool ok) override
+        {
+            const ChatMessage* write = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mOutbox.pop_front();
+                // The rpc is gone, nothing more can be written
+                if (!ok)
+                    mOutbox.clear();
+
+                if (mOutbox.empty())
+                    mWriting = false;
+                else
+                    write = &mOutbox.front();
+            }
+
+            if (write)
+                StartWrite(write);
+            else
+                finishIfDone();
+        }
+
+        void OnDone() override
+        {
+            mService->leaveChat(this);
+            mService->reactorDone();
+            release();
+        }
+
+        /** Keep the reactor alive while a note is delivered to it
+         */
+        void retain()
+        {
+            mReferences.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /** Drop a reference, the last one deletes the reactor
+         */
+        void release()
+        {
+            if (mReferences.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete this;
+        }
+
+    private:
+
+        /** Finish the rpc once the client is done and the outbox is written out, only once
+         */
+        void finishIfDone()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (!mClientDone || mWriting || mFinished)
+                    return;
+                mFinished = true;
+            }
+            Finish(grpc::Status::OK);
+        }
+
+        CallbackChatService* mService;
+        ChatMessage mNote; // Note being read, only touched by the read reactions
+        std::atomic<int> mReferences; // gRPC's and one per broadcast under way
+
+        std::mutex mMutex; // Guards the members below
+        std::deque<ChatMessage> mOutbox; // Notes to write, the front one is being written
+        bool mWriting;
+        bool mClientDone;
+        bool mFinished; // Finish() was called, nothing can be written anymore
+};
+
+/** Reactor of a WatchPresence rpc. The presence feed sends it updates through
+ * its watcher, which it queues in its outbox and writes one at a time. The rpc
+ * only ends when the client cancels it, the reactor then closes the watcher.
+ * The watcher keeps a reference on the reactor, as the feed may still hold it
+ * after the rpc is done, the last reference deletes it.
+ */
+class PresenceReactor final : public grpc::ServerWriteReactor<PresenceUpdate>
+{
+    public:
+
+        /** PresenceReactor Constructor, subscribes to the presence feed
+         * @param CallbackChatService* service: service to report to once done
+         * @param PresenceFeed& feed: feed of the presence changes
+         */
+        PresenceReactor(CallbackChatService* service, PresenceFeed& feed): mService(service)
+                                                                         , mReferences(1)
+                                                                         , mWatcher(std::make_shared<Watcher>(this))
+                                                                         , mWriting(false)
+                                                                         , mCancelled(false)
+                                                                         , mFinished(false)
+        {
+            feed.subscribe(mWatcher);
+        }
+
+        /** Queue an update, writing it right away if no write is in flight
+         * @param const PresenceUpdate& update: update to send
+         */
+        void deliver(const PresenceUpdate& update)
+        {
+            const PresenceUpdate* write = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (mFinished)
+                    return;
+
+                mOutbox.push_back(update);
+                if (!mWriting)
+                {
+                    mWriting = true;
+                    write = &mOutbox.front();
+                }
+            }
+            if (write)
+                StartWrite(write);
+        }
+
+        void OnWriteDone(bool ok) override
+        {
+            const PresenceUpdate* write = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mOutbox.pop_front();
+                // The rpc is gone, nothing more can be written
+                if (!ok)
+                {
+                    mOutbox.clear();
+                    mCancelled = true;
+                }
+
+                if (mOutbox.empty())
+                    mWriting = false;
+                else
+                    write = &mOutbox.front();
+            }
+
+            if (write)
+                StartWrite(write);
+            else
+                finishIfCancelled();
+        }
+
+        void OnCancel() override
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mCancelled = true;
+            }
+            finishIfCancelled();
+        }
+
+        void OnDone() override
+        {
+            mWatcher->close();
+            mWatcher.reset();
+            mService->reactorDone();
+            release();
+        }
+
+    private:
+
+        // What the feed holds, delivers the updates as long as the reactor is around
+        class Watcher final : public PresenceWatcher
+        {
+            public:
+
+                explicit Watcher(PresenceReactor* reactor): mReactor(reactor)
+                {
+                    mReactor->mReferences.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                ~Watcher()
+                {
+                    mReactor->release();
+                }
+
+                void send(const PresenceUpdate& update) override
+                {
+                    mReactor->deliver(update);
+                }
+
+            private:
+
+                PresenceReactor* mReactor;
+        };
+
+        /** Drop a reference, the last one deletes the reactor
+         */
+        void release()
+        {
+            if (mReferences.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete this;
+        }
+
+        /** Finish the rpc once it is cancelled and no write is in flight, only once
+         */
+        void finishIfCancelled()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (!mCancelled || mWriting || mFinished)
+                    return;
+                mFinished = true;
+            }
+            Finish(grpc::Status::CANCELLED);
+        }
+
+        CallbackChatService* mService;
+        std::atomic<int> mReferences; // gRPC's and the watcher's
+        std::shared_ptr<Watcher> mWatcher; // Reset once the rpc is done
+
+        std::mutex mMutex; // Guards the members below
+        std::deque<PresenceUpdate> mOutbox; // Updates to write, the front one is being written
+        bool mWriting;
+        bool mCancelled;
+        bool mFinished; // Finish() was called, nothing can be written anymore
+};
+
+/** CallbackChatService Constructor
+ * @param ChatCore& core: users and mailboxes to serve
+ */
+CallbackChatService::CallbackChatService(ChatCore& core): mCore(core)
+                                                        , mListCache(core)
+                                                        , mActiveReactors(0)
+                                                        , mBroadcasts(0)
+{
+    for (auto& calls : mCalls)
+        calls = 0;
+}
+
+/** Start a LogIn rpc, answers every name the client asks for
+ * @param grpc::CallbackServerContext* context: context of the rpc
+ * @return grpc::ServerBidiReactor<LogInRequest, LogInReply>*: reactor of the rpc
+ */
+grpc::ServerBidiReactor<LogInRequest, LogInReply>* CallbackChatService::LogIn(grpc::CallbackServerContext* context)
+{
+    mCalls[LOG_IN]++;
+    mActiveReactors++;
+    ChatCore& core = mCore;
+    return new ReplyReactor<LogInRequest, LogInReply>(this, [&core](const LogInRequest& request, LogInReply& reply)
+    {
+        uint32_t id = UserIdTable::NO_ID;
+        reply.set_loginstate(core.logIn(request.user(), id));
+        reply.set_userid(id);
+    });
+}
+
+/** Handle a LogOut rpc, sets the user offline
+ * @param grpc::CallbackServerContext* context: context of the rpc
+ * @param const LogOutRequest* request: the request
+ * @param LogOutReply* reply: the reply to fill
+ * @return grpc::ServerUnaryReactor*: the finished reactor of the rpc
+ */
+grpc::ServerUnaryReactor* CallbackChatService::LogOut(grpc::CallbackServerContext* context, const LogOutRequest* request, LogOutReply* reply)
+{
+    mCalls[LOG_OUT]++;
+    mCore.logOut(request->userid(), request->user());
+    reply->set_confirmation(LOG_OUT_CONFIRM);
+
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(grpc::Status::OK);
+    return reactor;
+}
+
+/** Start a SendMessage rpc. The client first checks that the recipient exists
+ * and then streams the messages for it.
+ * @param grpc::CallbackServerContext* context: context of the rpc
+ * @return grpc::ServerBidiReactor<SendMessageRequest, SendMessageReply>*: reactor of the rpc
+ */
+grpc::ServerBidiReactor<SendMessageRequest, SendMessageReply>* CallbackChatService::SendMessage(grpc::CallbackServerContext* context)
+{
+    mCalls[SEND_MESSAGE]++;
+    mActiveReactors++;
+    ChatCore& core = mCore;
+    return new ReplyReactor<SendMessageRequest, SendMessageReply>(this, [&core](const SendMessageRequest& request, SendMessageReply& reply)
+    {
+        Mailbox::Result result;
+        if(request.requeststate() == chatserver::SendMessageRequest::INITIAL)
+        {
+            // Check for existing user, the client can send its id from now on
+            if(uint32_t recipientId = core.findUser(request.recipientid(), request.recipient()))
+            {
+                reply.set_recipientstate(chatserver::SendMessageReply::EXIST);
+                reply.set_recipientid(recipientId);
+            }
+            else
+            {
+                reply.set_recipientstate(chatserver::SendMessageReply::NO_EXIST);
+                reply.set_confirmation(SEND_MESSAGE_NO_EXIST);
+            }
+        }
+        // Queue message
+        else if(core.queueMessage(request.recipientid(), request.recipient(),
+                                  {"Message from ", core.nameOf(request.userid(), request.user()), ": ", request.messages()},
+                                  result))
+        {
+            if(result == Mailbox::Result::REJECTED)
+                reply.set_confirmation(SEND_MESSAGE_MAILBOX_FULL);
+            else
+                reply.set_confirmation(SEND_MESSAGE_CONFIRM
+                                     + core.nameOf(request.recipientid(), request.recipient())
+                                     + "\n\n");
+        }
+        // Recipient was evicted since the client looked it up
+        else
+        {
+            reply.set_recipientstate(chatserver::SendMessageReply::NO_EXIST);
+            reply.set_confirmation(SEND_MESSAGE_NO_EXIST);
+        }
+    });
+}
+
+/** Start a ReceiveMessage rpc, streams the user's mailbox, and keeps pushing it if the client subscribed
+ * @param grpc::CallbackServerContext* context: context of the rpc
+ * @param const ReceiveMessageRequest* request: the request
+ * @return grpc::ServerWriteReactor<ReceiveMessageReply>*: reactor of the rpc
+ */
+grpc::ServerWriteReactor<ReceiveMessageReply>* CallbackChatService::ReceiveMessage(grpc::CallbackServerContext* context, const ReceiveMessageRequest* request)
+{
+    mCalls[RECEIVE_MESSAGE]++;
+    mActiveReactors++;
+    if (request->subscribe())
+        return new InboxReactor(this, mCore, request->userid(), request->user());
+    return new MailboxReactor(this, mCore, request->userid(), request->user());
+}
+
+/** Handle a List rpc, answers with the online users. The method is raw, the
+ * reply is the ListReply the cache serialized.
+ * @param grpc::CallbackServerContext* context: context of the rpc
+ * @param const grpc::ByteBuffer* request: the request, nothing in it is used
+ * @param grpc::ByteBuffer* reply: the reply to fill
+ * @return grpc::ServerUnaryReactor*: the finished reactor of the rpc
+ */
+grpc::ServerUnaryReactor* CallbackChatService::List(grpc::CallbackServerContext* context, const grpc::ByteBuffer* request, grpc::ByteBuffer* reply)
+{
+    mCalls[LIST]++;
+    *reply = mListCache.get();
+
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(grpc::Status::OK);
+    return reactor;
+}
+
+/** Handle a ListUsers rpc, answers with a page of the online users
+ * @param grpc::CallbackServerContext* context: context of the rpc
+ * @param const ListUsersRequest* request: prefix, limit and page token of the page
+ * @param ListUsersReply* reply: the reply to fill
+ * @return grpc::ServerUnaryReactor*: the finished reactor of the rpc
+ */
+grpc::ServerUnaryReactor* CallbackChatService::ListUsers(grpc::CallbackServerContext* context, const ListUsersRequest* request, ListUsersReply* reply)
+{
+    mCalls[LIST_USERS]++;
+    mCore.listUsers(*request, *reply);
+
+    grpc::ServerUnaryReactor* reactor = context->DefaultReactor();
+    reactor->Finish(grpc::Status::OK);
+    return reactor;
+}
+
+/** Start a WatchPresence rpc, the client gets a snapshot of the online users and then their changes
+ * @param grpc::CallbackServerContext* context: context of the rpc
+ * @param const WatchPresenceRequest* request: the request, nothing in it is used
+ * @return grpc::ServerWriteReactor<PresenceUpdate>*: reactor of the rpc
+ */
+grpc::ServerWriteReactor<PresenceUpdate>* CallbackChatService::WatchPresence(grpc::CallbackServerContext* context, const WatchPresenceRequest* request)
+{
+    mCalls[WATCH_PRESENCE]++;
+    mActiveReactors++;
+    return new PresenceReactor(this, mCore.presenceFeed());
+}
+
+/** Start a Chat rpc, passes every note on to the other clients on the chat
+ * @param grpc::CallbackServerContext* context: context of the rpc
+ * @return grpc::ServerBidiReactor<ChatMessage, ChatMessage>*: reactor of the rpc
+ */
+grpc::ServerBidiReactor<ChatMessage, ChatMessage>* CallbackChatService::Chat(grpc::CallbackServerContext* context)
+{
+    mCalls[CHAT]++;
+    mActiveReactors++;
+    return new ChatReactor(this);
+}
+
+/** Add a reactor to the chat
+ * @param ChatReactor* reactor: reactor of a Chat rpc
+ */
+void CallbackChatService::joinChat(ChatReactor* reactor)
+{
+    std::lock_guard<std::mutex> lock(mChatMutex);
+    mChatReactors.insert(reactor);
+}
+
+/** Remove a reactor from the chat, no broadcast reaches it afterwards
+ * @param ChatReactor* reactor: reactor of a Chat rpc
+ */
+void CallbackChatService::leaveChat(ChatReactor* reactor)
+{
+    std::lock_guard<std::mutex> lock(mChatMutex);
+    mChatReactors.erase(reactor);
+}
+
+/** Send a note to every reactor on the chat but its sender
+ * @param ChatReactor* sender: reactor the note came from
+ * @param const ChatMessage& note: note to send
+ */
+void CallbackChatService::broadcast(ChatReactor* sender, const ChatMessage& note)
+{
+    mBroadcasts++;
+
+    // Clients sending only their id are shown by name to the others
+    ChatMessage named;
+    const ChatMessage* sent = &note;
+    if(note.user().empty())
+    {
+        named = note;
+        named.set_user(mCore.nameOf(note.userid(), note.user()));
+        sent = &named;
+    }
+
+    // Hold a reference on the recipients instead of the lock while delivering,
+    // delivering may run their reactions inline
+    std::vector<ChatReactor*> recipients;
+    {
+        std::lock_guard<std::mutex> lock(mChatMutex);
+        recipients.reserve(mChatReactors.size());
+        for (ChatReactor* reactor : mChatReactors)
+        {
+            if (reactor == sender)
+                continue;
+            reactor->retain();
+            recipients.push_back(reactor);
+        }
+    }
+
+    for (ChatReactor* reactor : recipients)
+    {
+        reactor->deliver(*sent);
+        reactor->release();
+    }
+}
+
+/** Count a streaming rpc as done, called from the OnDone reaction of its reactor
+ */
+void CallbackChatService::reactorDone()
+{
+    mActiveReactors--;
+}
+
+/** Print the service counters
+ * @param std::ostream& out: stream to print to
+ */
+void CallbackChatService::printStats(std::ostream& out)
+{
+    for (int method = 0; method < RPC_METHOD_COUNT; method++)
+        out << "[stats] callback " << rpcMethodName((RpcMethod)method) << ": calls=" << mCalls[method].load(std::memory_order_relaxed) << "\n";
+
+    size_t chatMembers;
+    {
+        std::lock_guard<std::mutex> lock(mChatMutex);
+        chatMembers = mChatReactors.size();
+    }
+    out << "[stats] callback reactors: active=" << mActiveReactors.load(std::memory_order_relaxed)
+        << " chatMembers=" << chatMembers
+        << " broadcasts=" << mBroadcasts.load(std::memory_order_relaxed) << "\n";
+    out << "[stats] list cache: " << mListCache.getStats() << "\n";
+}
+
+/** CallbackServer Constructor
+ * @param const ServerOptions& options: the server options
+ * @param ChatCore& core: users and mailboxes to serve
+ */
+CallbackServer::CallbackServer(const ServerOptions& options, ChatCore& core): mOptions(options)
+                                                                            , mCore(core)
+                                                                            , mService(new CallbackChatService(core))
+                                                                            , mShuttingDown(false){}
+
+/** CallbackServer Destructor
+ */
+CallbackServer::~CallbackServer(){}
+
+/** Build the server and start listening, gRPC runs the reactors on its own threads
+ */
+void CallbackServer::Start()
+{
+    grpc::ServerBuilder builder;
+    // Listen on the given address without any authentication mechanism.
+    builder.AddListeningPort(mOptions.address, grpc::InsecureServerCredentials());
+    builder.RegisterService(mService.get());
+    mServer = builder.BuildAndStart();
+    std::cout << "Server listening on " << mOptions.address << " with the callback API" << std::endl;
+}
+
+/** Wait until Shutdown() is done and report how long the shutdown took
+ */
+void CallbackServer::Run()
+{
+    mServer->Wait();
+
+    // Nothing persists the mailboxes, at least say what is lost
+    size_t unreadMessages;
+    size_t usersWithMail;
+    mCore.countUnread(unreadMessages, usersWithMail);
+
+    auto drainTime = std::chrono::steady_clock::now() - mShutdownStart;
+    std::cout << "Server drained in " << std::chrono::duration_cast<std::chrono::milliseconds>(drainTime).count() << " ms"
+              << ", dropping " << unreadMessages << " unread message(s) of " << usersWithMail << " user(s)" << std::endl;
+}
+
+/** Stop accepting rpcs and give the in-flight ones drainTimeout seconds to finish, cancelling
+ * whatever still runs then. Blocks until every reactor is done, which makes Run() return.
+ * Can be called from any thread once Start() returned.
+ */
+void CallbackServer::Shutdown()
+{
+    if (mShuttingDown.exchange(true))
+        return;
+
+    mShutdownStart = std::chrono::steady_clock::now();
+    std::cout << "Shutting down, in-flight rpcs have " << mOptions.drainTimeout << " s to finish" << std::endl;
+
+    mServer->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(mOptions.drainTimeout));
+}
+
+/** Print the server counters: rpcs per method and reactors
+ * @param std::ostream& out: stream to print to
+ */
+void CallbackServer::printStats(std::ostream& out)
+{
+    mService->printStats(out);
+    out << "[stats] user directory: " << mCore.directory().getStats() << "\n";
+    out << "[stats] mailboxes: " << mCore.getMailboxStats() << "\n";
+    out << "[stats] presence: online=" << mCore.onlineCount() << "\n";
+    out << "[stats] presence feed: " << mCore.presenceFeed().getStats() << "\n";
+    out << "[stats] eviction: " << mCore.getEvictionStats() << "\n";
+    out.flush();
+}
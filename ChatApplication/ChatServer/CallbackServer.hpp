@@ -0,0 +1,41 @@
+#ifndef CALLBACK_SERVER_H
+#define CALLBACK_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <grpc++/grpc++.h>
+#include "ChatCore.hpp"
+#include "ChatServerEngine.hpp"
+#include "ServerOptions.hpp"
+
+class CallbackChatService;
+
+/** Engine serving the ChatServer service with gRPC's callback API: every rpc is
+ * a reactor reacting to its reads and writes on gRPC's own threads, so there is
+ * no completion queue, poller or dispatcher to run. Only the address, the drain
+ * timeout and the stats interval of the options apply to it.
+ */
+class CallbackServer final : public ChatServerEngine
+{
+    public:
+
+        CallbackServer(const ServerOptions& options, ChatCore& core);
+        ~CallbackServer();
+
+        void Start() override;
+        void Run() override;
+        void Shutdown() override;
+        void printStats(std::ostream& out) override;
+
+    private:
+
+        ServerOptions mOptions;
+        ChatCore& mCore;
+        std::unique_ptr<CallbackChatService> mService;
+        std::unique_ptr<grpc::Server> mServer;
+        std::atomic<bool> mShuttingDown;
+        std::chrono::steady_clock::time_point mShutdownStart;
+};
+
+#endif
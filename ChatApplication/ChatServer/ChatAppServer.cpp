@@ -10,11 +10,25 @@
 #include <unordered_set>
 #include <unistd.h>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <pthread.h>
 
 #include <grpc++/grpc++.h>
 #include "chatserver.grpc.pb.h"
-#include "UserNode.hpp"
+#include "ChatCore.hpp"
+#include "ChatServerEngine.hpp"
+#include "CallbackServer.hpp"
 #include "ChatServerGlobal.h"
+#include "CpuTopology.hpp"
+#include "ListReplyCache.hpp"
+#include "TagDispatcher.hpp"
+#include "WorkStealingExecutor.hpp"
+#include "Strand.hpp"
+#include "JobPool.hpp"
+#include "RpcCoroutine.hpp"
+#include "ServerOptions.hpp"
 
 using grpc::Server;
 using grpc::ServerAsyncResponseWriter;
@@ -34,57 +48,35 @@ using chatserver::SendMessageRequest;
 using chatserver::SendMessageReply;
 using chatserver::ReceiveMessageRequest;
 using chatserver::ReceiveMessageReply;
-using chatserver::ListRequest;
-using chatserver::ListReply;
 using chatserver::ChatMessage;
+using chatserver::ListUsersRequest;
+using chatserver::ListUsersReply;
+using chatserver::WatchPresenceRequest;
+using chatserver::PresenceUpdate;
 using chatserver::ChatServer;
 
+// The service the jobs are posted on. List is raw, its reply goes out as the ListReplyCache serialized it
+typedef ChatServer::WithRawMethod_List<ChatServer::AsyncService> ChatServerService;
+
 // Forward declaration
 class ServerImpl;
 static ServerImpl* gServerImpl;
+// The engine main() runs, ServerImpl or CallbackServer
+static ChatServerEngine* gEngine;
+// Set when tags are processed on the work-stealing executor, the jobs' strands then run on it
+static WorkStealingExecutor* gExecutor = nullptr;
 
 
-bool isValid(std::string name);
-
-/** Function to check whether or not name chosen is valid name
- * Name must contain only alphanumeric and no spaces
- * @param std::string name: string to be checked
- * @return bool: true if valid, false if not
- */
-bool isValid(std::string name)
-{
-    if(name == "")
-        return false;
-
-    for(int i = 0; i < name.length(); i++)
-    {
-        // letter must be A through z
-        if(name[i] < ALPHA_START || name[i] > ALPHA_END)
-            return false;
-    }
-    return true;
-}
-
 // Globals to analyze the results and make sure we are not leaking any rpcs
 static std::atomic_int32_t gUnaryRpcCounter(0);
 static std::atomic_int32_t gServerStreamingRpcCounter(0);
 static std::atomic_int32_t gClientStreamingRpcCounter(0);
 static std::atomic_int32_t gBidirectionalStreamingRpcCounter(0);
 
+// How often the server checks whether the last jobs are gone while draining on shutdown
+static const int DRAIN_POLL_MS = 10;
 
-// We add a 'TagProcessor' to the completion queue for each event. This way, each tag knows how to process itself. 
-using TagProcessor = std::function<void(bool)>;
-struct TagInfo
-{
-    TagProcessor* tagProcessor; // The function to be called to process incoming event
-    bool ok; // The result of tag processing as indicated by gRPC library. Calling it 'ok' to be in sync with other gRPC examples.
-};
-
-using TagList = std::list<TagInfo>;
 
-// As the tags become available from completion queue thread, we put them in a queue in order to process them on our application thread. 
-static TagList gIncomingTags;
-std::mutex gIncomingTagsMutex;
 // A base class for various rpc types. With gRPC, it is necessary to keep track of pending async operations.
 // Only 1 async operation can be pending at a time with an exception that both async read and write can be pending at the same time.
 class RpcJob
@@ -104,12 +96,18 @@ public:
         , mAsyncReadInProgress(false)
         , mAsyncWriteInProgress(false)
         , mOnDoneCalled(false)
+        , mStrand(std::make_shared<Strand>(gExecutor))
     {
 
     }
 
-    virtual ~RpcJob() {};
+    // Runs on the job's strand, anything still queued for the job is dropped
+    virtual ~RpcJob()
+    {
+        mStrand->close();
+    };
 
+    // The async op bookkeeping and everything else touching the job's state runs on its strand.
     void AsyncOpStarted(AsyncOpType opType)
     {
         ++mAsyncOpCounter;
@@ -178,6 +176,24 @@ public:
 
     // Each different rpc type need to implement the specialization of action when this rpc is done.
     virtual void Done() = 0;
+
+    // Hand an event of one of the job's tags to its strand, so the events of one job run one at a time and in completion order
+    // whichever thread polls or processes them.
+    void DispatchEvent(RpcTag* tag, bool ok)
+    {
+        mStrand->dispatch([tag, ok] { tag->job->OnEvent(tag->event, ok); });
+    }
+
+    // Strand the job's events and responses run on
+    const std::shared_ptr<Strand>& strand() const
+    {
+        return mStrand;
+    }
+
+protected:
+    // Each rpc type routes the events of its tags to its handlers.
+    virtual void OnEvent(RpcEvent event, bool ok) = 0;
+
 private:
     int32_t mAsyncOpCounter;
     bool mAsyncReadInProgress;
@@ -192,75 +208,81 @@ private:
     // This actually feels like a pretty odd behavior of the gRPC library (it is most likely a result of our multi-threaded usage) so we account for that by keeping track of whether the OnDone was called earlier. 
     // As far as the application is considered, the rpc is only 'done' when no asyn Ops are pending. 
     bool mOnDoneCalled;
+
+    std::shared_ptr<Strand> mStrand; // Outlives the job while its last event is running
 };
 
-// The application code communicates with our utility classes using these handlers. 
-template<typename ServiceType, typename RequestType, typename ResponseType>
-struct RpcJobHandlers
+/** Process an event that came out of the completion queue
+ * @param RpcTag* tag: tag of the event, a member of the job it belongs to
+ * @param bool ok: result of the event as reported by gRPC
+ */
+void processTag(RpcTag* tag, bool ok)
 {
-public:
-    // typedefs. See the comments below. 
-    using ProcessRequestHandler = std::function<void(ServiceType*, RpcJob*, const RequestType*)>;
-    using CreateRpcJobHandler = std::function<void()>;
-    using RpcJobDoneHandler = std::function<void(ServiceType*, RpcJob*, bool)>;
-
-    using SendResponseHandler = std::function<bool(const ResponseType*)>; // GRPC_TODO - change to a unique_ptr instead to avoid internal copying.
-    using RpcJobContextHandler = std::function<void(ServiceType*, RpcJob*, grpc::ServerContext*, SendResponseHandler)>;
-
-    // Job to Application code handlers/callbacks
-    ProcessRequestHandler processRequestHandler; // RpcJob calls this to inform the application of a new request to be processed. 
-    CreateRpcJobHandler createRpcJobHandler; // RpcJob calls this to inform the application to create a new RpcJob of this type.
-    RpcJobDoneHandler rpcJobDoneHandler; // RpcJob calls this to inform the application that this job is done now. 
-
-    // Application code to job
-    RpcJobContextHandler rpcJobContextHandler; // RpcJob calls this to inform the application of the entities it can use to respond to the rpc request.
-};
+    tag->job->DispatchEvent(tag, ok);
+}
 
-// Each rpc type specializes RpcJobHandlers by deriving from it as each of them have a different responder to talk back to gRPC library.
-template<typename ServiceType, typename RequestType, typename ResponseType>
-struct UnaryRpcJobHandlers : public RpcJobHandlers<ServiceType, RequestType, ResponseType>
+// Lets other jobs (Chat broadcasts) send responses to a job from their own strands, or other threads run code on
+// its strand. The response is copied and sent from the job's strand. The handle holds on to the strand, so it stays safe to use after the job is gone.
+template<typename JobType>
+class RpcJobHandle
 {
 public:
-    using GRPCResponder = grpc::ServerAsyncResponseWriter<ResponseType>;
-    using QueueRequestHandler = std::function<void(ServiceType*, grpc::ServerContext*, RequestType*, GRPCResponder*, grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void *)>;
+    explicit RpcJobHandle(JobType* job)
+        : mJob(job)
+        , mStrand(job->strand())
+    {
 
-    // Job to Application code handlers/callbacks
-    QueueRequestHandler queueRequestHandler; // RpcJob calls this to inform the application to queue up a request for enabling rpc handling.
-};
+    }
 
-template<typename ServiceType, typename RequestType, typename ResponseType>
-struct ServerStreamingRpcJobHandlers : public RpcJobHandlers<ServiceType, RequestType, ResponseType>
-{
-public:
-    using GRPCResponder = grpc::ServerAsyncWriter<ResponseType>;
-    using QueueRequestHandler = std::function<void(ServiceType*, grpc::ServerContext*, RequestType*, GRPCResponder*, grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void *)>;
+    // Returns false once the job is gone
+    bool send(const typename JobType::Response& response) const
+    {
+        JobType* job = mJob;
+        typename JobType::Response copy(response);
+        return mStrand->dispatch([job, copy] { job->SendResponse(&copy); });
+    }
 
-    // Job to Application code handlers/callbacks
-    QueueRequestHandler queueRequestHandler; // RpcJob calls this to inform the application to queue up a request for enabling rpc handling.
-};
+    // Runs function(job) on the job's strand, returns false once the job is gone
+    template<typename Function>
+    bool post(Function&& function) const
+    {
+        JobType* job = mJob;
+        return mStrand->dispatch([job, function] { function(*job); });
+    }
 
-template<typename ServiceType, typename RequestType, typename ResponseType>
-struct ClientStreamingRpcJobHandlers : public RpcJobHandlers<ServiceType, RequestType, ResponseType>
-{
-public:
-    using GRPCResponder = grpc::ServerAsyncReader<ResponseType, RequestType>;
-    using QueueRequestHandler = std::function<void(ServiceType*, grpc::ServerContext*, GRPCResponder*, grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void *)>;
+    JobType* job() const
+    {
+        return mJob;
+    }
 
-    // Job to Application code handlers/callbacks
-    QueueRequestHandler queueRequestHandler; // RpcJob calls this to inform the application to queue up a request for enabling rpc handling.
+private:
+    JobType* mJob;
+    std::shared_ptr<Strand> mStrand;
 };
 
-template<typename ServiceType, typename RequestType, typename ResponseType>
-struct BidirectionalStreamingRpcJobHandlers : public RpcJobHandlers<ServiceType, RequestType, ResponseType>
-{
-public:
-    using GRPCResponder = grpc::ServerAsyncReaderWriter<ResponseType, RequestType>;
-    using QueueRequestHandler = std::function<void(ServiceType*, grpc::ServerContext*, GRPCResponder*, grpc::CompletionQueue*, grpc::ServerCompletionQueue*, void *)>;
+/*
+The application tells a job what to do with a Method struct given as its template argument. The job calls it
+directly, there is no std::function or map lookup between an event and the application code:
 
-    // Job to Application code handlers/callbacks
-    QueueRequestHandler queueRequestHandler; // RpcJob calls this to inform the application to queue up a request for enabling rpc handling.
+struct Method
+{
+    using Service = ...;  // AsyncService the method belongs to
+    using Request = ...;
+    using Response = ...;
+    static constexpr auto queueRequest = &Service::RequestMethod; // Queues up a request for enabling rpc handling
+
+    template<typename JobType>
+    struct State;  // Application state kept inside the job, constructed from the job's pointer
+
+    static void started(JobType& job);  // A client picked the job up, the application creates a new RpcJob of this type
+    static void process(JobType& job, const Request* request);  // A request came in, nullptr once a streaming client is done
+    static void written(JobType& job);  // Every response sent so far is written, server streaming only
+    static void done(JobType& job);     // The job is done and about to be deleted
 };
 
+The application responds through the job's SendResponse() from the processors, which run on the job's strand, and
+through an RpcJobHandle from anywhere else.
+*/
 
 /*
 We implement UnaryRpcJob, ServerStreamingRpcJob, ClientStreamingRpcJob and BidirectionalStreamingRpcJob. The application deals with these classes.
@@ -269,40 +291,66 @@ As a convention, we always send grpc::Status::OK and add any error info in the g
 in a request to a client without completion of the rpc (and allow for more requests on same rpc). We do, however, allow server side cancellation of the rpc.
 */
 
-template<typename ServiceType, typename RequestType, typename ResponseType>
+template<typename Method>
 class UnaryRpcJob : public RpcJob
 {
-    using ThisRpcTypeJobHandlers = UnaryRpcJobHandlers<ServiceType, RequestType, ResponseType>;
+public:
+    using MethodType = Method;
+    using Request = typename Method::Request;
+    using Response = typename Method::Response;
+
+private:
+    using ServiceType = typename Method::Service;
+    using GRPCResponder = grpc::ServerAsyncResponseWriter<Response>;
 
 public:
-    UnaryRpcJob(ServiceType* service, grpc::ServerCompletionQueue* cq, ThisRpcTypeJobHandlers jobHandlers)
+    // Jobs of this type are recycled through their own free list instead of the heap
+    static void* operator new(size_t size)
+    {
+        return JobPool<UnaryRpcJob>::instance().allocate(size);
+    }
+
+    static void operator delete(void* memory, size_t size)
+    {
+        JobPool<UnaryRpcJob>::instance().release(memory, size);
+    }
+
+    UnaryRpcJob(ServiceType* service, grpc::ServerCompletionQueue* cq, int queue)
         : mService(service)
         , mCQ(cq)
         , mResponder(&mServerContext)
-        , mHandlers(jobHandlers)
+        , mQueue(queue)
+        , mState(this)
     {
         ++gUnaryRpcCounter;
 
-        // create TagProcessors that we'll use to interact with gRPC CompletionQueue
-        mOnRead = std::bind(&UnaryRpcJob::OnRead, this, std::placeholders::_1);
-        mOnFinish = std::bind(&UnaryRpcJob::OnFinish, this, std::placeholders::_1);
-        mOnDone = std::bind(&RpcJob::OnDone, this, std::placeholders::_1);
+        // create the tags that we'll use to interact with gRPC CompletionQueue
+        mOnRead = RpcTag{this, RpcEvent::READ};
+        mOnFinish = RpcTag{this, RpcEvent::FINISH};
+        mOnDone = RpcTag{this, RpcEvent::DONE};
 
         // set up the completion queue to inform us when gRPC is done with this rpc.
         mServerContext.AsyncNotifyWhenDone(&mOnDone);
 
-        // inform the application of the entities it can use to respond to the rpc
-        mSendResponse = std::bind(&UnaryRpcJob::SendResponse, this, std::placeholders::_1);
-        jobHandlers.rpcJobContextHandler(mService, this, &mServerContext, mSendResponse);
-
         // finally, issue the async request needed by gRPC to start handling this rpc.
         AsyncOpStarted(RpcJob::ASYNC_OP_TYPE_QUEUED_REQUEST);
-        mHandlers.queueRequestHandler(mService, &mServerContext, &mRequest, &mResponder, mCQ, mCQ, &mOnRead);
+        (mService->*Method::queueRequest)(&mServerContext, &mRequest, &mResponder, mCQ, mCQ, &mOnRead);
     }
 
-private:
+    // Index of the completion queue the job is posted on
+    int queue() const
+    {
+        return mQueue;
+    }
+
+    // Application state of the job
+    typename Method::template State<UnaryRpcJob>& state()
+    {
+        return mState;
+    }
 
-    bool SendResponse(const ResponseType* response)
+    // Responds to the rpc, the application calls it from the job's strand
+    bool SendResponse(const Response* response)
     {
         // We always expect a valid response for Unary rpc. If no response is available, use ServerContext::TryCancel.
         GPR_ASSERT(response);
@@ -317,21 +365,24 @@ private:
         return true;
     }
 
+private:
+
     void OnRead(bool ok)
     {
         // A request has come on the service which can now be handled. Create a new rpc of this type to allow the server to handle next request.
-        mHandlers.createRpcJobHandler();
+        Method::started(*this);
 
         if (AsyncOpFinished(RpcJob::ASYNC_OP_TYPE_QUEUED_REQUEST))
         {
             if (ok)
             {
                 // We have a request that can be responded to now. So process it. 
-                mHandlers.processRequestHandler(mService, this, &mRequest);
+                Method::process(*this, &mRequest);
             }
             else
             {
-                GPR_ASSERT(ok);
+                // The server shut down before a client picked the request up, no other event comes for this job
+                Done();
             }
         }
     }
@@ -341,9 +392,28 @@ private:
         AsyncOpFinished(RpcJob::ASYNC_OP_TYPE_FINISH);
     }
 
+    void OnEvent(RpcEvent event, bool ok) override
+    {
+        switch (event)
+        {
+        case RpcEvent::READ:
+            OnRead(ok);
+            break;
+        case RpcEvent::FINISH:
+            OnFinish(ok);
+            break;
+        case RpcEvent::DONE:
+            OnDone(ok);
+            break;
+        default:
+            GPR_ASSERT(false);
+        }
+    }
+
     void Done() override
     {
-        mHandlers.rpcJobDoneHandler(mService, this, mServerContext.IsCancelled());
+        Method::done(*this);
+        delete this;
 
         --gUnaryRpcCounter;
     }
@@ -352,62 +422,87 @@ private:
 
     ServiceType* mService;
     grpc::ServerCompletionQueue* mCQ;
-    typename ThisRpcTypeJobHandlers::GRPCResponder mResponder;
+    GRPCResponder mResponder;
     grpc::ServerContext mServerContext;
 
-    RequestType mRequest;
-    ResponseType mResponse;
+    Request mRequest;
+    Response mResponse;
 
-    ThisRpcTypeJobHandlers mHandlers;
+    int mQueue; // Index of the completion queue the job is posted on
 
-    typename ThisRpcTypeJobHandlers::SendResponseHandler mSendResponse;
+    typename Method::template State<UnaryRpcJob> mState;
 
-    TagProcessor mOnRead;
-    TagProcessor mOnFinish;
-    TagProcessor mOnDone;
+    RpcTag mOnRead;
+    RpcTag mOnFinish;
+    RpcTag mOnDone;
 };
 
 
 
-template<typename ServiceType, typename RequestType, typename ResponseType>
+template<typename Method>
 class ServerStreamingRpcJob : public RpcJob
 {
-    using ThisRpcTypeJobHandlers = ServerStreamingRpcJobHandlers<ServiceType, RequestType, ResponseType>;
+public:
+    using MethodType = Method;
+    using Request = typename Method::Request;
+    using Response = typename Method::Response;
+
+private:
+    using ServiceType = typename Method::Service;
+    using GRPCResponder = grpc::ServerAsyncWriter<Response>;
 
 public:
-    ServerStreamingRpcJob(ServiceType* service, grpc::ServerCompletionQueue* cq, ThisRpcTypeJobHandlers jobHandlers)
+    // Jobs of this type are recycled through their own free list instead of the heap
+    static void* operator new(size_t size)
+    {
+        return JobPool<ServerStreamingRpcJob>::instance().allocate(size);
+    }
+
+    static void operator delete(void* memory, size_t size)
+    {
+        JobPool<ServerStreamingRpcJob>::instance().release(memory, size);
+    }
+
+    ServerStreamingRpcJob(ServiceType* service, grpc::ServerCompletionQueue* cq, int queue)
         : mService(service)
         , mCQ(cq)
         , mResponder(&mServerContext)
-        , mHandlers(jobHandlers)
+        , mQueue(queue)
+        , mState(this)
         , mServerStreamingDone(false)
     {
         ++gServerStreamingRpcCounter;
 
-        // create TagProcessors that we'll use to interact with gRPC CompletionQueue
-        mOnRead = std::bind(&ServerStreamingRpcJob::OnRead, this, std::placeholders::_1);
-        mOnWrite = std::bind(&ServerStreamingRpcJob::OnWrite, this, std::placeholders::_1);
-        mOnFinish = std::bind(&ServerStreamingRpcJob::OnFinish, this, std::placeholders::_1);
-        mOnDone = std::bind(&RpcJob::OnDone, this, std::placeholders::_1);
+        // create the tags that we'll use to interact with gRPC CompletionQueue
+        mOnRead = RpcTag{this, RpcEvent::READ};
+        mOnWrite = RpcTag{this, RpcEvent::WRITE};
+        mOnFinish = RpcTag{this, RpcEvent::FINISH};
+        mOnDone = RpcTag{this, RpcEvent::DONE};
 
         // set up the completion queue to inform us when gRPC is done with this rpc.
         mServerContext.AsyncNotifyWhenDone(&mOnDone);
 
-        //inform the application of the entities it can use to respond to the rpc
-        mSendResponse = std::bind(&ServerStreamingRpcJob::SendResponse, this, std::placeholders::_1);
-        jobHandlers.rpcJobContextHandler(mService, this, &mServerContext, mSendResponse);
-
         // finally, issue the async request needed by gRPC to start handling this rpc.
         AsyncOpStarted(RpcJob::ASYNC_OP_TYPE_QUEUED_REQUEST);
-        mHandlers.queueRequestHandler(mService, &mServerContext, &mRequest, &mResponder, mCQ, mCQ, &mOnRead);
+        (mService->*Method::queueRequest)(&mServerContext, &mRequest, &mResponder, mCQ, mCQ, &mOnRead);
     }
 
-private:
+    // Index of the completion queue the job is posted on
+    int queue() const
+    {
+        return mQueue;
+    }
+
+    // Application state of the job
+    typename Method::template State<ServerStreamingRpcJob>& state()
+    {
+        return mState;
+    }
 
     // gRPC can only do one async write at a time but that is very inconvenient from the application point of view.
     // So we buffer the response below in a queue if gRPC lib is not ready for it. 
     // The application can send a null response in order to indicate the completion of server side streaming. 
-    bool SendResponse(const ResponseType* response)
+    bool SendResponse(const Response* response)
     {
         if (response != nullptr)
         {
@@ -431,6 +526,8 @@ private:
         return true;
     }
 
+private:
+
     void doSendResponse()
     {
         AsyncOpStarted(RpcJob::ASYNC_OP_TYPE_WRITE);
@@ -445,13 +542,18 @@ private:
 
     void OnRead(bool ok)
     {
-        mHandlers.createRpcJobHandler();
+        Method::started(*this);
 
         if (AsyncOpFinished(RpcJob::ASYNC_OP_TYPE_QUEUED_REQUEST))
         {
             if (ok)
             {
-                mHandlers.processRequestHandler(mService, this, &mRequest);
+                Method::process(*this, &mRequest);
+            }
+            else
+            {
+                // The server shut down before a client picked the request up, no other event comes for this job
+                Done();
             }
         }
     }
@@ -473,6 +575,10 @@ private:
                 {
                     doFinish();
                 }
+                else // The application can send more, the responses it may send now go out right away
+                {
+                    Method::written(*this);
+                }
             }
         }
     }
@@ -482,9 +588,31 @@ private:
         AsyncOpFinished(RpcJob::ASYNC_OP_TYPE_FINISH);
     }
 
+    void OnEvent(RpcEvent event, bool ok) override
+    {
+        switch (event)
+        {
+        case RpcEvent::READ:
+            OnRead(ok);
+            break;
+        case RpcEvent::WRITE:
+            OnWrite(ok);
+            break;
+        case RpcEvent::FINISH:
+            OnFinish(ok);
+            break;
+        case RpcEvent::DONE:
+            OnDone(ok);
+            break;
+        default:
+            GPR_ASSERT(false);
+        }
+    }
+
     void Done() override
     {
-        mHandlers.rpcJobDoneHandler(mService, this, mServerContext.IsCancelled());
+        Method::done(*this);
+        delete this;
 
         --gServerStreamingRpcCounter;
     }
@@ -493,61 +621,87 @@ private:
 
     ServiceType* mService;
     grpc::ServerCompletionQueue* mCQ;
-    typename ThisRpcTypeJobHandlers::GRPCResponder mResponder;
+    GRPCResponder mResponder;
     grpc::ServerContext mServerContext;
 
-    RequestType mRequest;
+    Request mRequest;
     
-    ThisRpcTypeJobHandlers mHandlers;
+    int mQueue; // Index of the completion queue the job is posted on
 
-    typename ThisRpcTypeJobHandlers::SendResponseHandler mSendResponse;
+    typename Method::template State<ServerStreamingRpcJob> mState;
 
-    TagProcessor mOnRead;
-    TagProcessor mOnWrite;
-    TagProcessor mOnFinish;
-    TagProcessor mOnDone;
+    RpcTag mOnRead;
+    RpcTag mOnWrite;
+    RpcTag mOnFinish;
+    RpcTag mOnDone;
 
-    std::list<ResponseType> mResponseQueue;
+    std::list<Response> mResponseQueue;
     bool mServerStreamingDone;
 };
 
 
-template<typename ServiceType, typename RequestType, typename ResponseType>
+template<typename Method>
 class ClientStreamingRpcJob : public RpcJob
 {
-    using ThisRpcTypeJobHandlers = ClientStreamingRpcJobHandlers<ServiceType, RequestType, ResponseType>;
+public:
+    using MethodType = Method;
+    using Request = typename Method::Request;
+    using Response = typename Method::Response;
+
+private:
+    using ServiceType = typename Method::Service;
+    using GRPCResponder = grpc::ServerAsyncReader<Response, Request>;
 
 public:
-    ClientStreamingRpcJob(ServiceType* service, grpc::ServerCompletionQueue* cq, ThisRpcTypeJobHandlers jobHandlers)
+    // Jobs of this type are recycled through their own free list instead of the heap
+    static void* operator new(size_t size)
+    {
+        return JobPool<ClientStreamingRpcJob>::instance().allocate(size);
+    }
+
+    static void operator delete(void* memory, size_t size)
+    {
+        JobPool<ClientStreamingRpcJob>::instance().release(memory, size);
+    }
+
+    ClientStreamingRpcJob(ServiceType* service, grpc::ServerCompletionQueue* cq, int queue)
         : mService(service)
         , mCQ(cq)
         , mResponder(&mServerContext)
-        , mHandlers(jobHandlers)
+        , mQueue(queue)
+        , mState(this)
         , mClientStreamingDone(false)
     {
         ++gClientStreamingRpcCounter;
 
-        // create TagProcessors that we'll use to interact with gRPC CompletionQueue
-        mOnInit = std::bind(&ClientStreamingRpcJob::OnInit, this, std::placeholders::_1);
-        mOnRead = std::bind(&ClientStreamingRpcJob::OnRead, this, std::placeholders::_1);
-        mOnFinish = std::bind(&ClientStreamingRpcJob::OnFinish, this, std::placeholders::_1);
-        mOnDone = std::bind(&RpcJob::OnDone, this, std::placeholders::_1);
+        // create the tags that we'll use to interact with gRPC CompletionQueue
+        mOnInit = RpcTag{this, RpcEvent::INIT};
+        mOnRead = RpcTag{this, RpcEvent::READ};
+        mOnFinish = RpcTag{this, RpcEvent::FINISH};
+        mOnDone = RpcTag{this, RpcEvent::DONE};
 
         // set up the completion queue to inform us when gRPC is done with this rpc.
         mServerContext.AsyncNotifyWhenDone(&mOnDone);
 
-        //inform the application of the entities it can use to respond to the rpc
-        mSendResponse = std::bind(&ClientStreamingRpcJob::SendResponse, this, std::placeholders::_1);
-        jobHandlers.rpcJobContextHandler(mService, this, &mServerContext, mSendResponse);
-
         // finally, issue the async request needed by gRPC to start handling this rpc.
         AsyncOpStarted(RpcJob::ASYNC_OP_TYPE_QUEUED_REQUEST);
-        mHandlers.queueRequestHandler(mService, &mServerContext, &mResponder, mCQ, mCQ, &mOnInit);
+        (mService->*Method::queueRequest)(&mServerContext, &mResponder, mCQ, mCQ, &mOnInit);
     }
 
-private:
+    // Index of the completion queue the job is posted on
+    int queue() const
+    {
+        return mQueue;
+    }
+
+    // Application state of the job
+    typename Method::template State<ClientStreamingRpcJob>& state()
+    {
+        return mState;
+    }
 
-    bool SendResponse(const ResponseType* response)
+    // Responds to the rpc, the application calls it from the job's strand
+    bool SendResponse(const Response* response)
     {
         // We always expect a valid response for client streaming rpc. If no response is available, use ServerContext::TryCancel.
         GPR_ASSERT(response);
@@ -570,9 +724,11 @@ private:
         return true;
     }
 
+private:
+
     void OnInit(bool ok)
     {
-        mHandlers.createRpcJobHandler();
+        Method::started(*this);
 
         if (AsyncOpFinished(RpcJob::ASYNC_OP_TYPE_QUEUED_REQUEST))
         {
@@ -581,6 +737,11 @@ private:
                 AsyncOpStarted(RpcJob::ASYNC_OP_TYPE_READ);
                 mResponder.Read(&mRequest, &mOnRead);
             }
+            else
+            {
+                // The server shut down before a client picked the request up, no other event comes for this job
+                Done();
+            }
         }
     }
 
@@ -591,7 +752,7 @@ private:
             if (ok)
             {
                 // inform application that a new request has come in
-                mHandlers.processRequestHandler(mService, this, &mRequest);
+                Method::process(*this, &mRequest);
 
                 // queue up another read operation for this rpc
                 AsyncOpStarted(RpcJob::ASYNC_OP_TYPE_READ);
@@ -600,7 +761,7 @@ private:
             else
             {
                 mClientStreamingDone = true;
-                mHandlers.processRequestHandler(mService, this, nullptr);
+                Method::process(*this, nullptr);
             }
         }
     }
@@ -610,9 +771,31 @@ private:
         AsyncOpFinished(RpcJob::ASYNC_OP_TYPE_FINISH);
     }
 
+    void OnEvent(RpcEvent event, bool ok) override
+    {
+        switch (event)
+        {
+        case RpcEvent::INIT:
+            OnInit(ok);
+            break;
+        case RpcEvent::READ:
+            OnRead(ok);
+            break;
+        case RpcEvent::FINISH:
+            OnFinish(ok);
+            break;
+        case RpcEvent::DONE:
+            OnDone(ok);
+            break;
+        default:
+            GPR_ASSERT(false);
+        }
+    }
+
     void Done() override
     {
-        mHandlers.rpcJobDoneHandler(mService, this, mServerContext.IsCancelled());
+        Method::done(*this);
+        delete this;
 
         --gClientStreamingRpcCounter;
     }
@@ -621,64 +804,90 @@ private:
 
     ServiceType* mService;
     grpc::ServerCompletionQueue* mCQ;
-    typename ThisRpcTypeJobHandlers::GRPCResponder mResponder;
+    GRPCResponder mResponder;
     grpc::ServerContext mServerContext;
 
-    RequestType mRequest;
-    ResponseType mResponse;
+    Request mRequest;
+    Response mResponse;
 
-    ThisRpcTypeJobHandlers mHandlers;
+    int mQueue; // Index of the completion queue the job is posted on
 
-    typename ThisRpcTypeJobHandlers::SendResponseHandler mSendResponse;
+    typename Method::template State<ClientStreamingRpcJob> mState;
 
-    TagProcessor mOnInit;
-    TagProcessor mOnRead;
-    TagProcessor mOnFinish;
-    TagProcessor mOnDone;
+    RpcTag mOnInit;
+    RpcTag mOnRead;
+    RpcTag mOnFinish;
+    RpcTag mOnDone;
 
     bool mClientStreamingDone;
 };
 
 
 
-template<typename ServiceType, typename RequestType, typename ResponseType>
+template<typename Method>
 class BidirectionalStreamingRpcJob : public RpcJob
 {
-    using ThisRpcTypeJobHandlers = BidirectionalStreamingRpcJobHandlers<ServiceType, RequestType, ResponseType>;
+public:
+    using MethodType = Method;
+    using Request = typename Method::Request;
+    using Response = typename Method::Response;
+
+private:
+    using ServiceType = typename Method::Service;
+    using GRPCResponder = grpc::ServerAsyncReaderWriter<Response, Request>;
 
 public:
-    BidirectionalStreamingRpcJob(ServiceType* service, grpc::ServerCompletionQueue* cq, ThisRpcTypeJobHandlers jobHandlers)
+    // Jobs of this type are recycled through their own free list instead of the heap
+    static void* operator new(size_t size)
+    {
+        return JobPool<BidirectionalStreamingRpcJob>::instance().allocate(size);
+    }
+
+    static void operator delete(void* memory, size_t size)
+    {
+        JobPool<BidirectionalStreamingRpcJob>::instance().release(memory, size);
+    }
+
+    BidirectionalStreamingRpcJob(ServiceType* service, grpc::ServerCompletionQueue* cq, int queue)
         : mService(service)
         , mCQ(cq)
         , mResponder(&mServerContext)
-        , mHandlers(jobHandlers)
+        , mQueue(queue)
+        , mState(this)
         , mServerStreamingDone(false)
         , mClientStreamingDone(false)
     {
         ++gBidirectionalStreamingRpcCounter;
 
-        // create TagProcessors that we'll use to interact with gRPC CompletionQueue
-        mOnInit = std::bind(&BidirectionalStreamingRpcJob::OnInit, this, std::placeholders::_1);
-        mOnRead = std::bind(&BidirectionalStreamingRpcJob::OnRead, this, std::placeholders::_1);
-        mOnWrite = std::bind(&BidirectionalStreamingRpcJob::OnWrite, this, std::placeholders::_1);
-        mOnFinish = std::bind(&BidirectionalStreamingRpcJob::OnFinish, this, std::placeholders::_1);
-        mOnDone = std::bind(&RpcJob::OnDone, this, std::placeholders::_1);
+        // create the tags that we'll use to interact with gRPC CompletionQueue
+        mOnInit = RpcTag{this, RpcEvent::INIT};
+        mOnRead = RpcTag{this, RpcEvent::READ};
+        mOnWrite = RpcTag{this, RpcEvent::WRITE};
+        mOnFinish = RpcTag{this, RpcEvent::FINISH};
+        mOnDone = RpcTag{this, RpcEvent::DONE};
 
         // set up the completion queue to inform us when gRPC is done with this rpc.
         mServerContext.AsyncNotifyWhenDone(&mOnDone);
 
-        //inform the application of the entities it can use to respond to the rpc
-        mSendResponse = std::bind(&BidirectionalStreamingRpcJob::SendResponse, this, std::placeholders::_1);
-        jobHandlers.rpcJobContextHandler(mService, this, &mServerContext, mSendResponse);
-
         // finally, issue the async request needed by gRPC to start handling this rpc.
         AsyncOpStarted(RpcJob::ASYNC_OP_TYPE_QUEUED_REQUEST);
-        mHandlers.queueRequestHandler(mService, &mServerContext, &mResponder, mCQ, mCQ, &mOnInit);
+        (mService->*Method::queueRequest)(&mServerContext, &mResponder, mCQ, mCQ, &mOnInit);
     }
 
-private:
+    // Index of the completion queue the job is posted on
+    int queue() const
+    {
+        return mQueue;
+    }
+
+    // Application state of the job
+    typename Method::template State<BidirectionalStreamingRpcJob>& state()
+    {
+        return mState;
+    }
 
-    bool SendResponse(const ResponseType* response)
+    // Responds to the rpc, the application calls it from the job's strand
+    bool SendResponse(const Response* response)
     {
         if (response == nullptr && !mClientStreamingDone)
         {
@@ -710,9 +919,11 @@ private:
         return true;
     }
 
+private:
+
     void OnInit(bool ok)
     {
-        mHandlers.createRpcJobHandler();
+        Method::started(*this);
 
         if (AsyncOpFinished(RpcJob::ASYNC_OP_TYPE_QUEUED_REQUEST))
         {
@@ -721,6 +932,11 @@ private:
                 AsyncOpStarted(RpcJob::ASYNC_OP_TYPE_READ);
                 mResponder.Read(&mRequest, &mOnRead);
             }
+            else
+            {
+                // The server shut down before a client picked the request up, no other event comes for this job
+                Done();
+            }
         }
     }
 
@@ -730,7 +946,7 @@ private:
         {
             if (ok)
             {
-                mHandlers.processRequestHandler(mService, this, &mRequest);
+                Method::process(*this, &mRequest);
                 // queue up another read operation for this rpc
                 AsyncOpStarted(RpcJob::ASYNC_OP_TYPE_READ);
                 mResponder.Read(&mRequest, &mOnRead);
@@ -739,7 +955,7 @@ private:
             {
                 std::cout << "Client Streaming Done\n";
                 mClientStreamingDone = true;
-                mHandlers.processRequestHandler(mService, this, nullptr);
+                Method::process(*this, nullptr);
             }
         }
     }
@@ -769,9 +985,34 @@ private:
         AsyncOpFinished(RpcJob::ASYNC_OP_TYPE_FINISH);
     }
 
+    void OnEvent(RpcEvent event, bool ok) override
+    {
+        switch (event)
+        {
+        case RpcEvent::INIT:
+            OnInit(ok);
+            break;
+        case RpcEvent::READ:
+            OnRead(ok);
+            break;
+        case RpcEvent::WRITE:
+            OnWrite(ok);
+            break;
+        case RpcEvent::FINISH:
+            OnFinish(ok);
+            break;
+        case RpcEvent::DONE:
+            OnDone(ok);
+            break;
+        default:
+            GPR_ASSERT(false);
+        }
+    }
+
     void Done() override
     {
-        mHandlers.rpcJobDoneHandler(mService, this, mServerContext.IsCancelled());
+        Method::done(*this);
+        delete this;
 
         --gBidirectionalStreamingRpcCounter;
     }
@@ -792,23 +1033,23 @@ private:
 
     ServiceType* mService;
     grpc::ServerCompletionQueue* mCQ;
-    typename ThisRpcTypeJobHandlers::GRPCResponder mResponder;
+    GRPCResponder mResponder;
     grpc::ServerContext mServerContext;
 
-    RequestType mRequest;
+    Request mRequest;
 
-    ThisRpcTypeJobHandlers mHandlers;
+    int mQueue; // Index of the completion queue the job is posted on
 
-    typename ThisRpcTypeJobHandlers::SendResponseHandler mSendResponse;
+    typename Method::template State<BidirectionalStreamingRpcJob> mState;
 
-    TagProcessor mOnInit;
-    TagProcessor mOnRead;
-    TagProcessor mOnWrite;
-    TagProcessor mOnFinish;
-    TagProcessor mOnDone;
+    RpcTag mOnInit;
+    RpcTag mOnRead;
+    RpcTag mOnWrite;
+    RpcTag mOnFinish;
+    RpcTag mOnDone;
 
 
-    std::list<ResponseType> mResponseQueue;
+    std::list<Response> mResponseQueue;
     bool mServerStreamingDone;
     bool mClientStreamingDone;
 };
@@ -817,22 +1058,48 @@ private:
 
 
 
-class ServerImpl final : public ChatServer::AsyncService
+/** Engine driving the RpcJob state machines over completion queues
+ */
+class ServerImpl final : public ChatServer::AsyncService, public ChatServerEngine
 {
     public:
-    	ServerImpl(){}
-
-	    ~ServerImpl()
+    	ServerImpl(const ServerOptions& options, ChatCore& core): mOptions(options)
+	                                                            , mSlotPools(new SlotPool[options.threads * RPC_METHOD_COUNT])
+	                                                            , mShuttingDown(false)
+	                                                            , mCore(core)
+	                                                            , mListCache(core)
 	    {
-	        mServer->Shutdown();
-	        mCQ->Shutdown();
+	        if (mOptions.affinity == ServerOptions::AffinityMode::COMPACT)
+	            placeThreads();
+
+	        // Inline dispatch runs the tags on the pollers, there is nothing to hand over
+	        if (mOptions.dispatchMode == ServerOptions::DispatchMode::INLINE)
+	            return;
+
+	        if (mOptions.dispatchMode == ServerOptions::DispatchMode::EXECUTOR)
+	        {
+	            mExecutor.reset(new WorkStealingExecutor(mOptions.workers));
+	            gExecutor = mExecutor.get();
+	            return;
+	        }
+
+	        mDispatchers.resize(mOptions.threads);
+	        for (int i = 0; i < mOptions.threads; i++)
+	        {
+	            auto create = [this, i] { mDispatchers[i].reset(new TagDispatcher(mOptions.spinCount, mOptions.queueCapacity)); };
+	            // Allocate the queue on the node of the worker thread that drains it
+	            if (mDispatcherCpus.empty())
+	                create();
+	            else
+	                runOnCpu(mDispatcherCpus[i], create);
+	        }
 	    }
 
-
-        // There is no shutdown handling in this code.
-        void Run() 
+        /** Build the server and post the pending jobs, it accepts rpcs once Run() picks up their tags
+         */
+        void Start() override
         {
-            std::string server_address("0.0.0.0:50051");
+            std::string server_address(mOptions.address);
 
             grpc::ServerBuilder builder;
             // Listen on the given address without any authentication mechanism.
@@ -840,586 +1107,871 @@ class ServerImpl final : public ChatServer::AsyncService
             // Register "service_" as the instance through which we'll communicate with
             // clients. In this case it corresponds to an *asynchronous* service.
             builder.RegisterService(&mChatServerService);
-            // Get hold of the completion queue used for the asynchronous communication
-            // with the gRPC runtime.
-            mCQ = builder.AddCompletionQueue();
+            // Get hold of the completion queues used for the asynchronous communication
+            // with the gRPC runtime, each one gets its own poller and worker thread.
+            for (int i = 0; i < mOptions.threads; i++)
+            {
+                mCQs.push_back(builder.AddCompletionQueue());
+            }
             // Finally assemble the server.
             mServer = builder.BuildAndStart();
-            std::cout << "Server listening on " << server_address << std::endl;
+            std::cout << "Server listening on " << server_address
+                      << " with " << mOptions.threads << " completion queue(s)" << std::endl;
 
-            // Proceed to the server's main loop.
-            HandleRpcs();
+            // Post the pending jobs on every queue before any thread starts picking up tags
+            for (int i = 0; i < mOptions.threads; i++)
+            {
+                fillSlotPool<SendMessageMethod>(i);
+                fillSlotPool<ReceiveMessageMethod>(i);
+                fillSlotPool<ChatMethod>(i);
+                fillSlotPool<LogInMethod>(i);
+                fillSlotPool<LogOutMethod>(i);
+                fillSlotPool<ListMethod>(i);
+                fillSlotPool<ListUsersMethod>(i);
+                fillSlotPool<WatchPresenceMethod>(i);
+            }
         }
 
+        /** Process rpcs until Shutdown() is done, then stop the dispatchers and report
+         * how long the shutdown took
+         */
+        void Run() override
+        {
+            // On the executor the pollers run the tags inline as well, which only posts them to the jobs' strands
+            bool handoff = (mOptions.dispatchMode == ServerOptions::DispatchMode::HANDOFF);
+            void (ServerImpl::*handleRpcs)(int) = handoff ? &ServerImpl::HandleRpcs : &ServerImpl::HandleRpcsInline;
 
-    private:
+            if (mExecutor)
+            {
+                mExecutor->start(mWorkerCpus);
+                std::cout << "Processing tags on " << mExecutor->workers() << " executor worker(s)" << std::endl;
+            }
 
-        void createLogOutRpc()
-        {
-            UnaryRpcJobHandlers<chatserver::ChatServer::AsyncService, LogOutRequest, LogOutReply> jobHandlers;
-            jobHandlers.rpcJobContextHandler = &LogOutContextSetterImpl;
-            jobHandlers.rpcJobDoneHandler = &LogOutDone;
-            jobHandlers.createRpcJobHandler = std::bind(&ServerImpl::createLogOutRpc, this);
-            jobHandlers.queueRequestHandler = &chatserver::ChatServer::AsyncService::RequestLogOut;
-            jobHandlers.processRequestHandler = &LogOutProcessor;
-
-            new UnaryRpcJob<chatserver::ChatServer::AsyncService, LogOutRequest, LogOutReply>(&mChatServerService, mCQ.get(), jobHandlers);
-        }
-    
-        struct LogOutResponder
-        {
-            std::function<bool(chatserver::LogOutReply*)> sendFunc;
-            grpc::ServerContext* serverContext;
-        };
+            // Pin the threads first thing if they were placed
+            auto poll = [this, handleRpcs](int cq)
+            {
+                if (!mPollerCpus.empty())
+                    pinCurrentThread(mPollerCpus[cq]);
+                (this->*handleRpcs)(cq);
+            };
+            auto dispatch = [this](int cq)
+            {
+                if (!mDispatcherCpus.empty())
+                    pinCurrentThread(mDispatcherCpus[cq]);
+                mDispatchers[cq]->run();
+            };
+
+            std::vector<std::thread> dispatcherThreads;
+            std::vector<std::thread> pollerThreads;
+            for (int i = 0; i < mOptions.threads; i++)
+            {
+                // As the tags become available from completion queue thread, we put them in a queue in order to process them on the queue's worker thread.
+                if (handoff)
+                    dispatcherThreads.emplace_back(dispatch, i);
+                if (i > 0)
+                    pollerThreads.emplace_back(poll, i);
+            }
 
-        std::unordered_map<RpcJob*, LogOutResponder> mLogOutResponders;
-        static void LogOutContextSetterImpl(chatserver::ChatServer::AsyncService* service, RpcJob* job, ServerContext* serverContext, std::function<bool(LogOutReply*)> sendResponse)
-        {
-            LogOutResponder responder;
-            responder.sendFunc = sendResponse;
-            responder.serverContext = serverContext;
+            // Proceed to the server's main loop, it returns once the queue is shut down and empty.
+            poll(0);
+
+            for (auto& thread : pollerThreads)
+                thread.join();
+
+            // Every job is gone, so nothing is left to dispatch
+            for (auto& dispatcher : mDispatchers)
+                dispatcher->stop();
+            for (auto& thread : dispatcherThreads)
+                thread.join();
+            if (mExecutor)
+                mExecutor->stop();
+
+            // Nothing persists the mailboxes, at least say what is lost
+            size_t unreadMessages;
+            size_t usersWithMail;
+            mCore.countUnread(unreadMessages, usersWithMail);
 
-            gServerImpl->mLogOutResponders[job] = responder;
+            auto drainTime = std::chrono::steady_clock::now() - mShutdownStart;
+            std::cout << "Server drained in " << std::chrono::duration_cast<std::chrono::milliseconds>(drainTime).count() << " ms"
+                      << ", dropping " << unreadMessages << " unread message(s) of " << usersWithMail << " user(s)" << std::endl;
         }
 
-        static void LogOutProcessor(chatserver::ChatServer::AsyncService* service, RpcJob* job, const chatserver::LogOutRequest* request)
+        /** Stop accepting rpcs and give the in-flight ones drainTimeout seconds to finish, cancelling
+         * whatever still runs then. Blocks until every job is done and shuts the completion queues
+         * down, which makes Run() return. Can be called from any thread once Start() returned,
+         * the pollers must keep running meanwhile.
+         */
+        void Shutdown() override
         {
-            // Get user's name
-            std::string name = request->user();
-            LogOutReply reply;
-            reply.set_confirmation(LOG_OUT_CONFIRM);
-
-            // Set UserNode's online status to false
-            gServerImpl->users_[name]->setOnline(false);
-            // Send back reply
-            gServerImpl->mLogOutResponders[job].sendFunc(&reply);
+            if (mShuttingDown.exchange(true))
+                return;
+
+            mShutdownStart = std::chrono::steady_clock::now();
+            std::cout << "Shutting down, in-flight rpcs have " << mOptions.drainTimeout << " s to finish" << std::endl;
+
+            mServer->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(mOptions.drainTimeout));
+
+            // The cancelled jobs and the posted ones that never got a client still have their last
+            // events to process, which may start operations. A completion queue accepts no new
+            // operation once it is shut down, so wait for every job to be done first.
+            while (gUnaryRpcCounter + gServerStreamingRpcCounter + gClientStreamingRpcCounter + gBidirectionalStreamingRpcCounter > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(DRAIN_POLL_MS));
+
+            for (auto& cq : mCQs)
+                cq->Shutdown();
         }
 
-        static void LogOutDone(chatserver::ChatServer::AsyncService* service, RpcJob* job, bool rpcCancelled)
+        /** Print the server counters: dispatchers or executor, slot pools and job pools
+         * @param std::ostream& out: stream to print to
+         */
+        void printStats(std::ostream& out) override
         {
-            gServerImpl->mLogOutResponders.erase(job);
-            delete job;
+            for (size_t i = 0; i < mDispatchers.size(); i++)
+                out << "[stats] dispatcher " << i << ": " << mDispatchers[i]->getStats() << "\n";
+            if (mExecutor)
+                out << "[stats] executor: " << mExecutor->getStats() << "\n";
+
+            for (int method = 0; method < RPC_METHOD_COUNT; method++)
+            {
+                int outstanding = 0;
+                uint64_t accepted = 0;
+                uint64_t dry = 0;
+                for (int i = 0; i < mOptions.threads; i++)
+                {
+                    SlotPool& pool = slotPool((RpcMethod)method, i);
+                    outstanding += pool.outstanding.load(std::memory_order_relaxed);
+                    accepted += pool.accepted.load(std::memory_order_relaxed);
+                    dry += pool.dry.load(std::memory_order_relaxed);
+                }
+                out << "[stats] slots " << rpcMethodName((RpcMethod)method) << ": perQueue=" << mOptions.slots[method]
+                    << " outstanding=" << outstanding << " accepted=" << accepted << " dry=" << dry << "\n";
+            }
+
+            out << "[stats] job pool login: " << JobPool<LogInMethod::Job>::instance().getStats() << "\n"
+                << "[stats] job pool logout: " << JobPool<LogOutMethod::Job>::instance().getStats() << "\n"
+                << "[stats] job pool send-message: " << JobPool<SendMessageMethod::Job>::instance().getStats() << "\n"
+                << "[stats] job pool receive-message: " << JobPool<ReceiveMessageMethod::Job>::instance().getStats() << "\n"
+                << "[stats] job pool list: " << JobPool<ListMethod::Job>::instance().getStats() << "\n"
+                << "[stats] job pool list-users: " << JobPool<ListUsersMethod::Job>::instance().getStats() << "\n"
+                << "[stats] job pool watch-presence: " << JobPool<WatchPresenceMethod::Job>::instance().getStats() << "\n"
+                << "[stats] job pool chat: " << JobPool<ChatMethod::Job>::instance().getStats() << "\n"
+                << "[stats] coroutine frame pool: " << FramePool::instance().getStats() << "\n"
+                << "[stats] user directory: " << mCore.directory().getStats() << "\n"
+                << "[stats] mailboxes: " << mCore.getMailboxStats() << "\n"
+                << "[stats] presence: online=" << mCore.onlineCount() << "\n"
+                << "[stats] presence feed: " << mCore.presenceFeed().getStats() << "\n"
+                << "[stats] eviction: " << mCore.getEvictionStats() << "\n"
+                << "[stats] list cache: " << mListCache.getStats() << "\n";
+            out.flush();
         }
 
-        void createListRpc()
+
+    private:
+
+        /** Give every thread Run() starts a cpu of its own, the worker thread of each completion
+         * queue next to its poller and the executor workers after them, and log the placement
+         */
+        void placeThreads()
         {
-            UnaryRpcJobHandlers<chatserver::ChatServer::AsyncService, ListRequest, ListReply> jobHandlers;
-            jobHandlers.rpcJobContextHandler = &ListContextSetterImpl;
-            jobHandlers.rpcJobDoneHandler = &ListDone;
-            jobHandlers.createRpcJobHandler = std::bind(&ServerImpl::createListRpc, this);
-            jobHandlers.queueRequestHandler = &chatserver::ChatServer::AsyncService::RequestList;
-            jobHandlers.processRequestHandler = &ListProcessor;
-
-            new UnaryRpcJob<chatserver::ChatServer::AsyncService, ListRequest, ListReply>(&mChatServerService, mCQ.get(), jobHandlers);
+            CpuTopology topology = CpuTopology::detect();
+            std::cout << "CPU topology: " << topology << std::endl;
+            if (topology.cpus().empty())
+                return;
+
+            auto place = [&topology](const std::string& thread)
+            {
+                const CpuTopology::Cpu& cpu = topology.next();
+                std::cout << "  " << thread << " -> cpu " << cpu.id << " (node " << cpu.node << ")" << std::endl;
+                return cpu.id;
+            };
+
+            for (int i = 0; i < mOptions.threads; i++)
+            {
+                mPollerCpus.push_back(place("poller " + std::to_string(i)));
+                if (mOptions.dispatchMode == ServerOptions::DispatchMode::HANDOFF)
+                    mDispatcherCpus.push_back(place("worker thread " + std::to_string(i)));
+            }
+
+            if (mOptions.dispatchMode == ServerOptions::DispatchMode::EXECUTOR)
+            {
+                for (int i = 0; i < mOptions.workers; i++)
+                    mWorkerCpus.push_back(place("executor worker " + std::to_string(i)));
+            }
         }
-    
-        struct ListResponder
+
+        /** Counters of the jobs of one method kept posted on one completion queue
+         */
+        struct SlotPool
         {
-            std::function<bool(chatserver::ListReply*)> sendFunc;
-            grpc::ServerContext* serverContext;
+            SlotPool(): outstanding(0), accepted(0), dry(0) {}
+
+            std::atomic<int> outstanding;   // Posted jobs not picked up by a client yet
+            std::atomic<uint64_t> accepted; // Jobs picked up by a client
+            std::atomic<uint64_t> dry;      // Times a client took the last posted job, so the next one had to wait for its replacement
         };
 
-        std::unordered_map<RpcJob*, ListResponder> mListResponders;
-        static void ListContextSetterImpl(chatserver::ChatServer::AsyncService* service, RpcJob* job, ServerContext* serverContext, std::function<bool(ListReply*)> sendResponse)
+        /** Accessor for the slot counters of a method on a completion queue
+         * @param RpcMethod method: method of the jobs
+         * @param int cq: index of the completion queue
+         * @return SlotPool&: the counters
+         */
+        SlotPool& slotPool(RpcMethod method, int cq)
         {
-            ListResponder responder;
-            responder.sendFunc = sendResponse;
-            responder.serverContext = serverContext;
-
-            gServerImpl->mListResponders[job] = responder;
+            return mSlotPools[cq * RPC_METHOD_COUNT + method];
         }
 
-        static void ListProcessor(chatserver::ChatServer::AsyncService* service, RpcJob* job, const chatserver::ListRequest* request)
+        /** Count a job posted to wait for a client
+         * @param RpcMethod method: method of the job
+         * @param int cq: index of the completion queue the job is posted on
+         */
+        void slotPosted(RpcMethod method, int cq)
         {
-            std::string list;
-            ListReply reply;
-            auto it = gServerImpl->users_.begin();
-
-            // Iterate through all existing users
-            for(auto it = gServerImpl->users_.begin()
-              ; it != gServerImpl->users_.end()
-              ; it++)
-            {
-                // If user currently online
-                if(it->second->getOnline())
-                {
-                    // Format list of users
-                    list += ("[" + it->second->getName() + "] ");
-                }
-                
-            }
-            list += "\n\n";
-            reply.set_list(list);
-
-            gServerImpl->mListResponders[job].sendFunc(&reply);
+            slotPool(method, cq).outstanding.fetch_add(1, std::memory_order_relaxed);
         }
 
-        static void ListDone(chatserver::ChatServer::AsyncService* service, RpcJob* job, bool rpcCancelled)
+        /** Count a posted job picked up by a client, before its replacement is posted
+         * @param RpcMethod method: method of the job
+         * @param int cq: index of the completion queue the job was posted on
+         */
+        void slotTaken(RpcMethod method, int cq)
         {
-            gServerImpl->mListResponders.erase(job);
-            delete job;
+            SlotPool& pool = slotPool(method, cq);
+            pool.accepted.fetch_add(1, std::memory_order_relaxed);
+            if (pool.outstanding.fetch_sub(1, std::memory_order_relaxed) == 1)
+                pool.dry.fetch_add(1, std::memory_order_relaxed);
         }
 
-        /** Update job handlers for ReceiveMessageRPC
+        /** Post the configured number of jobs of a method on a completion queue. Each one
+         * posts its own replacement when it is picked up, so the number stays the same.
+         * @param int cq: index of the completion queue to post the jobs on
          */
-        void createReceiveMessageRpc()
+        template<typename Method>
+        void fillSlotPool(int cq)
         {
-            ServerStreamingRpcJobHandlers<chatserver::ChatServer::AsyncService, ReceiveMessageRequest, ReceiveMessageReply> jobHandlers;
-            jobHandlers.rpcJobContextHandler = &ReceiveMessageContextSetterImpl;
-            jobHandlers.rpcJobDoneHandler = &ReceiveMessageDone;
-            jobHandlers.createRpcJobHandler = std::bind(&ServerImpl::createReceiveMessageRpc, this);
-            jobHandlers.queueRequestHandler = &chatserver::ChatServer::AsyncService::RequestReceiveMessage;
-            jobHandlers.processRequestHandler = &ReceiveMessageProcessor;
-
-            // Server sends multiple messages back, server streaming
-            new ServerStreamingRpcJob<chatserver::ChatServer::AsyncService, ReceiveMessageRequest, ReceiveMessageReply>(&mChatServerService, mCQ.get(), jobHandlers);
+            for (int n = 0; n < mOptions.slots[Method::method]; n++)
+                createRpc<Method>(cq, nullptr);
         }
 
-        struct ReceiveMessageResponder
+        /** Post a job of a method to wait for a client
+         * @param int cq: index of the completion queue to post the job on
+         * @param RpcJob* startedJob: job that was just picked up by a client, nullptr when filling the pool
+         */
+        template<typename Method>
+        void createRpc(int cq, RpcJob* startedJob)
         {
-            std::function<bool(ReceiveMessageReply*)> sendFunc;
-            grpc::ServerContext* serverContext;
-        };
+            // The job calling back was just picked up by a client, this one takes its place
+            if (startedJob)
+                slotTaken(Method::method, cq);
 
-        std::unordered_map<RpcJob*, ReceiveMessageResponder> mReceiveMessageResponders;
-        static void ReceiveMessageContextSetterImpl(chatserver::ChatServer::AsyncService* service, RpcJob* job, grpc::ServerContext* serverContext, std::function<bool(ReceiveMessageReply*)> sendResponse)
-        {
-            ReceiveMessageResponder responder;
-            responder.sendFunc = sendResponse;
-            responder.serverContext = serverContext;
+            // Nothing takes its place once the server is shutting down
+            if (mShuttingDown.load())
+                return;
 
-            gServerImpl->mReceiveMessageResponders[job] = responder;
+            slotPosted(Method::method, cq);
+            new typename Method::Job(&mChatServerService, mCQs[cq].get(), cq);
         }
 
-        static void ReceiveMessageProcessor(chatserver::ChatServer::AsyncService* service, RpcJob* job, const ReceiveMessageRequest *request)
+        /** Base of the method descriptions the jobs are instantiated with, see the
+         * description of a Method next to the jobs. A job picked up by a client posts
+         * its replacement on the same completion queue, and keeps no state of its own.
+         */
+        template<typename Method>
+        struct ServedMethod
         {
-            ReceiveMessageReply reply;
-            if(request)
+            using Service = ChatServerService;
+
+            template<typename JobType>
+            struct State
             {
-                
-                // Obtain user's name
-                std::string name = request->user();
-                // Access UserNode from map
-                UserNode* user = gServerImpl->users_[name];
-                // Get pair of message queue state and message
-                auto pair = user->getMessage();               
-
-                // Update proto fields depending on state of queue
-                if(pair.first == UserNode::QUEUE_STATE::EMPTY) 
-                {
-                    reply.set_queuestate(chatserver::ReceiveMessageReply::EMPTY);
-                    gServerImpl->mReceiveMessageResponders[job].sendFunc(nullptr);
-                }
-                else if(pair.first == UserNode::QUEUE_STATE::NON_EMPTY)
-                {
-                    reply.set_queuestate(chatserver::ReceiveMessageReply::NON_EMPTY);
-                    reply.set_messages(pair.second); 
-                    gServerImpl->mReceiveMessageResponders[job].sendFunc(&reply);
-                }
+                explicit State(JobType*){}
+            };
 
+            template<typename JobType>
+            static void started(JobType& job)
+            {
+                gServerImpl->createRpc<Method>(job.queue(), &job);
+            }
 
-                while(reply.queuestate() == chatserver::ReceiveMessageReply::NON_EMPTY)
-                {
-                    pair = user->getMessage();
-                    if(pair.first == UserNode::QUEUE_STATE::EMPTY) 
-                    {
-                        reply.set_queuestate(chatserver::ReceiveMessageReply::EMPTY);
-                        reply.set_messages(pair.second);            
-                        gServerImpl->mReceiveMessageResponders[job].sendFunc(&reply);
-                        gServerImpl->mReceiveMessageResponders[job].sendFunc(nullptr);
-                    }
-                    else if(pair.first == UserNode::QUEUE_STATE::NON_EMPTY)
-                    {
-                        reply.set_queuestate(chatserver::ReceiveMessageReply::NON_EMPTY);
-                        reply.set_messages(pair.second);            
-                        gServerImpl->mReceiveMessageResponders[job].sendFunc(&reply);
+            template<typename JobType>
+            static void written(JobType& job){}
 
-                    }         
-                }
-            }
-            else
+            template<typename JobType>
+            static void done(JobType& job){}
+        };
+
+        /** Base of the methods whose handler is a coroutine, see RpcCoroutine.hpp. Their
+         * jobs keep the coroutine's stream and hand it every request.
+         */
+        template<typename Method>
+        struct CoroutineMethod : ServedMethod<Method>
+        {
+            template<typename JobType>
+            using State = RpcStream<JobType>;
+
+            template<typename JobType>
+            static void process(JobType& job, const typename JobType::Request* request)
             {
-                gServerImpl->mReceiveMessageResponders[job].sendFunc(nullptr);
+                job.state().deliver(request);
             }
-        }
+        };
 
-        static void ReceiveMessageDone(chatserver::ChatServer::AsyncService* service, RpcJob* job, bool rpcCancelled)
+        struct LogOutMethod : ServedMethod<LogOutMethod>
         {
-            gServerImpl->mReceiveMessageResponders.erase(job);
-            delete job;
-        }
+            using Request = LogOutRequest;
+            using Response = LogOutReply;
+            using Job = UnaryRpcJob<LogOutMethod>;
+            static constexpr RpcMethod method = LOG_OUT;
+            static constexpr auto queueRequest = &Service::RequestLogOut;
 
-        void createSendMessageRpc()
-        {
+            static void process(Job& job, const LogOutRequest* request)
+            {
+                LogOutReply reply;
+                reply.set_confirmation(LOG_OUT_CONFIRM);
 
-            BidirectionalStreamingRpcJobHandlers<chatserver::ChatServer::AsyncService, SendMessageRequest, SendMessageReply> jobHandlers;
-            jobHandlers.rpcJobContextHandler = &SendMessageContextSetterImpl;
-            jobHandlers.rpcJobDoneHandler = &SendMessageDone;
-            jobHandlers.createRpcJobHandler = std::bind(&ServerImpl::createSendMessageRpc, this);
-            jobHandlers.queueRequestHandler = &chatserver::ChatServer::AsyncService::RequestSendMessage;
-            jobHandlers.processRequestHandler = &SendMessageProcessor;
+                // Set UserNode's online status to false
+                gServerImpl->mCore.logOut(request->userid(), request->user());
+                // Send back reply
+                job.SendResponse(&reply);
+            }
+        };
 
-            new BidirectionalStreamingRpcJob<chatserver::ChatServer::AsyncService, SendMessageRequest, SendMessageReply>(&mChatServerService, mCQ.get(), jobHandlers);
-        }
-    
-        struct SendMessageResponder
+        struct ListMethod : ServedMethod<ListMethod>
         {
-            std::function<bool(chatserver::SendMessageReply*)> sendFunc;
-            grpc::ServerContext* serverContext;
+            // Raw, the request has nothing to parse and the reply is serialized already
+            using Request = grpc::ByteBuffer;
+            using Response = grpc::ByteBuffer;
+            using Job = UnaryRpcJob<ListMethod>;
+            static constexpr RpcMethod method = LIST;
+            static constexpr auto queueRequest = &Service::RequestList;
+
+            static void process(Job& job, const grpc::ByteBuffer* request)
+            {
+                grpc::ByteBuffer reply = gServerImpl->mListCache.get();
+
+                job.SendResponse(&reply);
+            }
         };
 
-        std::unordered_map<RpcJob*, SendMessageResponder> mSendMessageResponders;
-        static void SendMessageContextSetterImpl(chatserver::ChatServer::AsyncService* service, RpcJob* job, ServerContext* serverContext, std::function<bool(SendMessageReply*)> sendResponse)
+        struct ListUsersMethod : ServedMethod<ListUsersMethod>
         {
-            SendMessageResponder responder;
-            responder.sendFunc = sendResponse;
-            responder.serverContext = serverContext;
+            using Request = ListUsersRequest;
+            using Response = ListUsersReply;
+            using Job = UnaryRpcJob<ListUsersMethod>;
+            static constexpr RpcMethod method = LIST_USERS;
+            static constexpr auto queueRequest = &Service::RequestListUsers;
 
-            gServerImpl->mSendMessageResponders[job] = responder;
-        }
+            static void process(Job& job, const ListUsersRequest* request)
+            {
+                ListUsersReply reply;
+                gServerImpl->mCore.listUsers(*request, reply);
 
-        static void SendMessageProcessor(chatserver::ChatServer::AsyncService* service, RpcJob* job, const chatserver::SendMessageRequest* request)
+                job.SendResponse(&reply);
+            }
+        };
+
+        // The stream stays open, the presence feed writes to it through a handle on the job
+        struct WatchPresenceMethod : ServedMethod<WatchPresenceMethod>
         {
-            chatserver::SendMessageReply reply;
-            if(request)
+            using Request = WatchPresenceRequest;
+            using Response = PresenceUpdate;
+            using Job = ServerStreamingRpcJob<WatchPresenceMethod>;
+            static constexpr RpcMethod method = WATCH_PRESENCE;
+            static constexpr auto queueRequest = &Service::RequestWatchPresence;
+
+            class Watcher;
+
+            template<typename JobType>
+            struct State
             {
-                if(request->requeststate() == chatserver::SendMessageRequest::INITIAL)
-                {
-                    auto recipientIterator = gServerImpl->users_.find(request->recipient());
-                    // Check for existing user
-                    if(recipientIterator != gServerImpl->users_.end())
-                    {
-                        reply.set_recipientstate(chatserver::SendMessageReply::EXIST);
-                    }
-                    else
-                    {
-                        reply.set_recipientstate(chatserver::SendMessageReply::NO_EXIST);
-                        reply.set_confirmation(SEND_MESSAGE_NO_EXIST);
-                    }
+                explicit State(JobType*){}
 
-                }
-                else
-                {
-                    // Access recipient UserNode from map
-                    auto recipientIterator = gServerImpl->users_.find(request->recipient());
-                    // Check for existing user
-                    if(recipientIterator != gServerImpl->users_.end())
-                    {
-                        auto recipient = recipientIterator->second;
-                        auto name = request->user();
-                        auto message = request->messages();
+                std::shared_ptr<Watcher> watcher; // Set once a client picked the job up
+            };
 
-                        time_t now = time(0);
-                        tm *gmtm = gmtime(&now);
-                        char* dt = asctime(gmtm);
+            // The handle stays safe to send to once the job is gone
+            class Watcher final : public PresenceWatcher
+            {
+                public:
 
-                        // Queue message
-                        recipientIterator->second->addMessage("Message from " + name + ": " + message);
+                    explicit Watcher(Job* job): mJob(job){}
 
-                        // Set fields
-                        reply.set_confirmation(SEND_MESSAGE_CONFIRM
-                                             + request->recipient()
-                                             + "\n\n");
+                    void send(const PresenceUpdate& update) override
+                    {
+                        mJob.send(update);
                     }
-                }
-                gServerImpl->mSendMessageResponders[job].sendFunc(&reply);
+
+                private:
+
+                    RpcJobHandle<Job> mJob;
+            };
+
+            static void process(Job& job, const WatchPresenceRequest* request)
+            {
+                job.state().watcher = std::make_shared<Watcher>(&job);
+                gServerImpl->mCore.presenceFeed().subscribe(job.state().watcher);
             }
-            else
+
+            static void done(Job& job)
             {
-                gServerImpl->mSendMessageResponders[job].sendFunc(nullptr);
+                if (job.state().watcher)
+                    job.state().watcher->close();
             }
-        }
+        };
 
-        static void SendMessageDone(chatserver::ChatServer::AsyncService* service, RpcJob* job, bool rpcCancelled)
+        // Server sends multiple messages back, server streaming. A subscribed stream stays open and the
+        // senders wake it up, it takes a batch out of the mailbox each time the one before is written
+        struct ReceiveMessageMethod : ServedMethod<ReceiveMessageMethod>
         {
-            gServerImpl->mLogInResponders.erase(job);
-            delete job;
-        }
+            using Request = ReceiveMessageRequest;
+            using Response = ReceiveMessageReply;
+            using Job = ServerStreamingRpcJob<ReceiveMessageMethod>;
+            static constexpr RpcMethod method = RECEIVE_MESSAGE;
+            static constexpr auto queueRequest = &Service::RequestReceiveMessage;
 
-        /** Create a BidirectionStreamingRpcJob with Chat RPC specifications
-         */
-        void createChatRpc()
-        {
-            BidirectionalStreamingRpcJobHandlers<chatserver::ChatServer::AsyncService, ChatMessage, ChatMessage> jobHandlers;
-            jobHandlers.rpcJobContextHandler = &ChatContextSetterImpl;
-            jobHandlers.rpcJobDoneHandler = &ChatDone;
-            jobHandlers.createRpcJobHandler = std::bind(&ServerImpl::createChatRpc, this);
-            jobHandlers.queueRequestHandler = &chatserver::ChatServer::AsyncService::RequestChat;
-            jobHandlers.processRequestHandler = &ChatProcessor;
-
-            // Spawn the job to be used later
-            new BidirectionalStreamingRpcJob<chatserver::ChatServer::AsyncService, ChatMessage, ChatMessage>(&mChatServerService, mCQ.get(), jobHandlers);
-        }
+            class Inbox;
 
-        /** Struct to hold sending function
-         */
-        struct ChatResponder
-        {
-            std::function<bool(chatserver::ChatMessage*)> sendFunc;
-            grpc::ServerContext* serverContext;
-        };
+            template<typename JobType>
+            struct State
+            {
+                explicit State(JobType*): userId(0)
+                                        , writing(false)
+                                        , finished(false){}
+
+                std::shared_ptr<Inbox> inbox; // Set once the client subscribed
+                uint32_t userId;
+                std::string user;
+                bool writing;  // A batch is being written, the next one waits for written()
+                bool finished; // The stream was ended, its subscription was replaced
+            };
+
+            // What the user's node holds, wakes the job up from the senders' threads. The handle
+            // stays safe to post to once the job is gone.
+            class Inbox final : public MailboxSubscriber
+            {
+                public:
 
-        // Usage shown in ChatProcessor();
-        ChatResponder *newResponder;
-        // Map to responders
-        std::unordered_map<RpcJob*, ChatResponder*> mChatResponders;
+                    explicit Inbox(Job* job): mJob(job)
+                                            , mPending(false){}
 
-        /** Sets up responders for Chat RPC
-         * @param AsyncService* service:
-         * @param RpcJob* job: current RPC
-         * @param sendResponse: Function that defines how to send the message
-         */
-        static void ChatContextSetterImpl(chatserver::ChatServer::AsyncService* service, RpcJob* job
-                                        , ServerContext* serverContext
-                                        , std::function<bool(ChatMessage*)> 
-                                                             sendResponse)
-        {
-            // Responder object
-            ChatResponder *responder = new ChatResponder();
-            // Assign function
-            responder->sendFunc = sendResponse;
-            // Assign context
-            responder->serverContext = serverContext;
-
-            // New responder is not assigned to any client
-            // usage of this shown in ChatProcessor()
-            gServerImpl->newResponder = responder;
-            gServerImpl->mChatResponders[job] = responder;
-        }
+                    void notify() override
+                    {
+                        // One wakeup in flight is enough, it takes every message queued before it runs
+                        if(!mPending.exchange(true, std::memory_order_acq_rel))
+                            mJob.post([](Job& job) { deliver(job); });
+                    }
 
+                    // Called by the wakeup before it takes the messages
+                    void clearPending()
+                    {
+                        mPending.store(false, std::memory_order_release);
+                    }
 
-    
-        /** Processor for Chat RPC
-         * @param AsyncService* service:
-         * @param RpcJob* job: current rpc request is coming from
-         * @param const ChatMessage* note: pointer to message that must be sent
-         */
-        static void ChatProcessor(chatserver::ChatServer::AsyncService* service, RpcJob* job, const ChatMessage* note)
-        {
-            if (note)
+                private:
+
+                    RpcJobHandle<Job> mJob;
+                    std::atomic<bool> mPending;
+            };
+
+            /** Write the next batch of a subscribed stream unless one is being written, or end the
+             * stream if a newer subscription replaced it
+             * @param Job& job: job of the stream
+             */
+            static void deliver(Job& job)
             {
-                // Copy note
-                ChatMessage responseNote(*note);
-                auto responders = gServerImpl->mChatResponders;
-                // Single new responder that is spawned every time CHAT
-                // RPC is request by client
-                auto unassignedResponder = gServerImpl->newResponder;
-
-                if(responseNote.messages() != DONE)
+                State<Job>& state = job.state();
+                state.inbox->clearPending();
+                if(state.writing || state.finished)
+                    return;
+
+                if(state.inbox->closed())
                 {
-              
-                    // Iterate through every responder currently on the chat 
-                    for(auto it = responders.begin()
-                      ; it != responders.end()
-                      ; it++)
-                    {
-                        auto currJobResponder = it->second;
+                    state.finished = true;
+                    job.SendResponse(nullptr);
+                    return;
+                }
 
-                        // Ignore the unassigned responder, will segfault
-                        // Ignore the current job responder because don't need
-                        // to send self messages
-                        if((currJobResponder != unassignedResponder) 
-                        &&  currJobResponder != responders[job])
-                        {
-                            // Send note
-                            it->second->sendFunc(&responseNote);
-                        }
-                    }
+                std::vector<std::string> messages;
+                if(!gServerImpl->mCore.takeMessages(state.userId, state.user, messages, Mailbox::DRAIN_BATCH))
+                    return;
+
+                ReceiveMessageReply reply;
+                reply.set_queuestate(chatserver::ReceiveMessageReply::NON_EMPTY);
+                for(std::string& message : messages)
+                {
+                    reply.set_messages(std::move(message));
+                    job.SendResponse(&reply);
                 }
+                state.writing = true;
             }
-            else
+
+            static void written(Job& job)
             {
-                gServerImpl->mChatResponders[job]->sendFunc(nullptr);
+                if(job.state().inbox)
+                {
+                    job.state().writing = false;
+                    deliver(job);
+                }
             }
-        }
-   
 
-        /** Deallocate memory taken by Chat RPC instances
-         */
-        static void ChatDone(chatserver::ChatServer::AsyncService* service, RpcJob* job, bool rpcCancelled)
-        {
-            // Deallocate dynamic responder
-            delete gServerImpl->mChatResponders[job];
-            // Remove responder from map
-            gServerImpl->mChatResponders.erase(job);
-            // Delete rpc instance
-            delete job;
-        }
+            static void done(Job& job)
+            {
+                State<Job>& state = job.state();
+                if(state.inbox)
+                {
+                    state.inbox->close();
+                    gServerImpl->mCore.unsubscribe(state.userId, state.user, state.inbox.get());
+                }
+            }
 
-        /** Create a BidirectionStreamingRpcJob with LogIn RPC specifications
-         */
-        void createLogInRpc()
-        {
-            BidirectionalStreamingRpcJobHandlers<chatserver::ChatServer::AsyncService, LogInRequest, LogInReply> jobHandlers;
-            jobHandlers.rpcJobContextHandler = &LogInContextSetterImpl;
-            jobHandlers.rpcJobDoneHandler = &LogInDone;
-            jobHandlers.createRpcJobHandler = std::bind(&ServerImpl::createLogInRpc, this);
-            jobHandlers.queueRequestHandler = &chatserver::ChatServer::AsyncService::RequestLogIn;
-            jobHandlers.processRequestHandler = &LogInProcessor;
-
-            // Spawn the job to be used later
-            new BidirectionalStreamingRpcJob<chatserver::ChatServer::AsyncService, LogInRequest, LogInReply>(&mChatServerService, mCQ.get(), jobHandlers);
-        }
+            static void process(Job& job, const ReceiveMessageRequest* request)
+            {
+                ReceiveMessageReply reply;
+                if(request && request->subscribe())
+                {
+                    State<Job>& state = job.state();
+                    state.userId = request->userid();
+                    state.user = request->user();
+                    state.inbox = std::make_shared<Inbox>(&job);
+                    if(gServerImpl->mCore.subscribe(state.userId, state.user, state.inbox))
+                    {
+                        // What was queued before the subscription goes out first
+                        deliver(job);
+                    }
+                    else
+                    {
+                        state.inbox.reset();
+                        job.SendResponse(nullptr);
+                    }
+                }
+                else if(request)
+                {
+                    ChatCore& core = gServerImpl->mCore;
+                    std::vector<std::string> messages;
+                    bool wrote = false;
 
-        /** Struct to hold sending function
-         */
-        struct LogInResponder
-        {
-            std::function<bool(chatserver::LogInReply*)> sendFunc;
-            grpc::ServerContext* serverContext;
-        };
+                    // Take the messages a batch at a time and move each one into its reply
+                    while(core.takeMessages(request->userid(), request->user(), messages, Mailbox::DRAIN_BATCH))
+                    {
+                        for(std::string& message : messages)
+                        {
+                            reply.set_queuestate(chatserver::ReceiveMessageReply::NON_EMPTY);
+                            reply.set_messages(message);
+                            job.SendResponse(&reply);
+                        }
+                        wrote = true;
+                    }
 
-        // Map to responders
-        std::unordered_map<RpcJob*, LogInResponder> mLogInResponders;
+                    // A mailbox that had messages ends with an EMPTY reply, an empty one with none
+                    if(wrote)
+                    {
+                        reply.set_queuestate(chatserver::ReceiveMessageReply::EMPTY);
+                        reply.set_messages(RECEIVE_MESSAGE_EMPTY);
+                        job.SendResponse(&reply);
+                    }
+                    job.SendResponse(nullptr);
+                }
+                else
+                {
+                    job.SendResponse(nullptr);
+                }
+            }
+        };
 
-        /** Sets up responders for LogIn RPC
-         * @param AsyncService* service:
-         * @param RpcJob* job: current RPC
-         * @param sendResponse: Function that defines how to send the message
-         */
-        static void LogInContextSetterImpl(chatserver::ChatServer::AsyncService* service, RpcJob* job
-                                        , ServerContext* serverContext
-                                        , std::function<bool(LogInReply*)> 
-                                                             sendResponse)
-        {
-            // Responder object
-            LogInResponder responder;
-            // Assign function
-            responder.sendFunc = sendResponse;
-            // Assign context
-            responder.serverContext = serverContext;
-
-            gServerImpl->mLogInResponders[job] = responder;
-        }
-    
-        /** Processor for Chat RPC
-         * @param AsyncService* service:
-         * @param RpcJob* job: current rpc request is coming from
-         * @param const ChatMessage* note: pointer to message that must be sent
-         */
-        static void LogInProcessor(chatserver::ChatServer::AsyncService* service, RpcJob* job, const LogInRequest* request)
+        struct SendMessageMethod : CoroutineMethod<SendMessageMethod>
         {
-            LogInReply reply;
-            if(request)
+            using Request = SendMessageRequest;
+            using Response = SendMessageReply;
+            using Job = BidirectionalStreamingRpcJob<SendMessageMethod>;
+            static constexpr RpcMethod method = SEND_MESSAGE;
+            static constexpr auto queueRequest = &Service::RequestSendMessage;
+
+            /** Handler of a SendMessage rpc. The client first checks that the recipient exists
+             * and then streams the messages for it.
+             * @param RpcStream<Job>& stream: stream of the rpc
+             */
+            static RpcHandler handle(RpcStream<Job>& stream)
             {
-                auto user = request->user();
-                // User's desired name is not valid
-                if(!isValid(user))
-                {
-                    reply.set_loginstate(chatserver::LogInReply::INVALID);
-                }
-                // User's name has been used before
-                else if(gServerImpl->users_.find(user) != gServerImpl->users_.end())
+                while (const SendMessageRequest* request = co_await stream.read())
                 {
-                    // Someone is currently online with that name
-                    if(gServerImpl->users_[user]->getOnline())
+                    ChatCore& core = gServerImpl->mCore;
+                    SendMessageReply reply;
+                    Mailbox::Result result;
+                    if(request->requeststate() == chatserver::SendMessageRequest::INITIAL)
+                    {
+                        // Check for existing user, the client can send its id from now on
+                        if(uint32_t recipientId = core.findUser(request->recipientid(), request->recipient()))
+                        {
+                            reply.set_recipientstate(chatserver::SendMessageReply::EXIST);
+                            reply.set_recipientid(recipientId);
+                        }
+                        else
+                        {
+                            reply.set_recipientstate(chatserver::SendMessageReply::NO_EXIST);
+                            reply.set_confirmation(SEND_MESSAGE_NO_EXIST);
+                        }
+                    }
+                    // Queue message
+                    else if(core.queueMessage(request->recipientid(), request->recipient(),
+                                              {"Message from ", core.nameOf(request->userid(), request->user()), ": ", request->messages()},
+                                              result))
                     {
-                        reply.set_loginstate(chatserver::LogInReply::ALREADY);                        
+                        // Set fields
+                        if(result == Mailbox::Result::REJECTED)
+                            reply.set_confirmation(SEND_MESSAGE_MAILBOX_FULL);
+                        else
+                            reply.set_confirmation(SEND_MESSAGE_CONFIRM
+                                                 + core.nameOf(request->recipientid(), request->recipient())
+                                                 + "\n\n");
                     }
-                    // No one is currently online with that name
+                    // Recipient was evicted since the client looked it up
                     else
                     {
-                        reply.set_loginstate(chatserver::LogInReply::SUCCESS);
-                        // Set online
-                        gServerImpl->users_[user]->setOnline(true);             
+                        reply.set_recipientstate(chatserver::SendMessageReply::NO_EXIST);
+                        reply.set_confirmation(SEND_MESSAGE_NO_EXIST);
                     }
+
+                    co_await stream.write(reply);
                 }
-                // User's desired name has never before been used
-                else
+            }
+        };
+
+        struct ChatMethod : CoroutineMethod<ChatMethod>
+        {
+            using Request = ChatMessage;
+            using Response = ChatMessage;
+            using Job = BidirectionalStreamingRpcJob<ChatMethod>;
+            static constexpr RpcMethod method = CHAT;
+            static constexpr auto queueRequest = &Service::RequestChat;
+
+            // The started job has a client now, so it can take part in the broadcasts
+            static void started(Job& job)
+            {
                 {
-                    // Create new user
-                    auto newNode = new UserNode(user);
-                    newNode->setOnline(true);
-                    gServerImpl->users_[user] = newNode;
-                    reply.set_loginstate(chatserver::LogInReply::SUCCESS);
+                    std::lock_guard<std::mutex> lock(gServerImpl->mChatMutex);
+                    gServerImpl->mChatJobs.insert(&job);
                 }
-                gServerImpl->mLogInResponders[job].sendFunc(&reply);
+                gServerImpl->createRpc<ChatMethod>(job.queue(), &job);
             }
-            else
+
+            static void done(Job& job)
             {
-                gServerImpl->mLogInResponders[job].sendFunc(nullptr);
+                std::lock_guard<std::mutex> lock(gServerImpl->mChatMutex);
+                gServerImpl->mChatJobs.erase(&job);
             }
-        }
-   
 
-        /** Deallocate memory taken by Chat RPC instances
-         */
-        static void LogInDone(chatserver::ChatServer::AsyncService* service, RpcJob* job, bool rpcCancelled)
-        {
-            // Deallocate dynamic responder
-            delete gServerImpl->mChatResponders[job];
-            // Remove responder from map
-            gServerImpl->mChatResponders.erase(job);
-            // Delete rpc instance
-            delete job;
-        }
+            /** Handler of a Chat rpc, passes every note on to the other clients on the chat
+             * @param RpcStream<Job>& stream: stream of the rpc
+             */
+            static RpcHandler handle(RpcStream<Job>& stream)
+            {
+                while (const ChatMessage* note = co_await stream.read())
+                {
+                    if(note->messages() == DONE)
+                        continue;
 
+                    // Clients sending only their id are shown by name to the others
+                    ChatMessage named;
+                    if(note->user().empty())
+                    {
+                        named = *note;
+                        named.set_user(gServerImpl->mCore.nameOf(note->userid(), note->user()));
+                        note = &named;
+                    }
 
+                    // Take handles on the other jobs, each one queues the note on its job's strand
+                    // and stays valid after the job is gone, so no lock is held while sending
+                    std::vector<RpcJobHandle<Job>> recipients;
+                    {
+                        std::lock_guard<std::mutex> lock(gServerImpl->mChatMutex);
+                        recipients.reserve(gServerImpl->mChatJobs.size());
+                        for(Job* member : gServerImpl->mChatJobs)
+                        {
+                            // Don't need to send self messages
+                            if(member != stream.job())
+                                recipients.emplace_back(member);
+                        }
+                    }
 
+                    for(auto& recipient : recipients)
+                    {
+                        // Send note
+                        recipient.send(*note);
+                    }
+                }
+            }
+        };
 
-        /** Initialize RPC services, push RPC's for processRpcs() to handle
-         */
-        void HandleRpcs() 
+        struct LogInMethod : CoroutineMethod<LogInMethod>
         {
+            using Request = LogInRequest;
+            using Response = LogInReply;
+            using Job = BidirectionalStreamingRpcJob<LogInMethod>;
+            static constexpr RpcMethod method = LOG_IN;
+            static constexpr auto queueRequest = &Service::RequestLogIn;
+
+            /** Handler of a LogIn rpc, answers every name the client asks for
+             * @param RpcStream<Job>& stream: stream of the rpc
+             */
+            static RpcHandler handle(RpcStream<Job>& stream)
+            {
+                while (const LogInRequest* request = co_await stream.read())
+                {
+                    LogInReply reply;
+                    uint32_t id = UserIdTable::NO_ID;
+                    reply.set_loginstate(gServerImpl->mCore.logIn(request->user(), id));
+                    reply.set_userid(id);
 
-            createSendMessageRpc();
-            createReceiveMessageRpc();
-            createChatRpc();
-            createLogInRpc();
-            createLogOutRpc();
-            createListRpc();
+                    co_await stream.write(reply);
+                }
+            }
+        };
 
-            TagInfo tagInfo;
-            while (true) 
+
+        /** Poll a completion queue, push its tags for the queue's worker thread to handle,
+         * until the queue is shut down and drained
+         * @param int cq: index of the completion queue to poll
+         */
+        void HandleRpcs(int cq) 
+        {
+            TagInfo tags[TagDispatcher::MAX_BATCH];
+            // Block waiting to read the next event from the completion queue. The
+            // event is uniquely identified by its the memory address
+            // The return value of Next should always be checked. This return value
+            // tells us whether there is any kind of event or cq_ is shutting down.
+            while (mCQs[cq]->Next((void**)&tags[0].tag, &tags[0].ok)) 
             {
-                // Block waiting to read the next event from the completion queue. The
-                // event is uniquely identified by its the memory address
-                // The return value of Next should always be checked. This return value
-                // tells us whether there is any kind of event or cq_ is shutting down.
-                GPR_ASSERT(mCQ->Next((void**)&tagInfo.tagProcessor, &tagInfo.ok)); //GRPC_TODO - Handle returned value
+                // Pick up whatever else is already completed without blocking, so a burst is handed over in one go
+                size_t count = 1;
+                while (count < TagDispatcher::MAX_BATCH
+                    && mCQs[cq]->AsyncNext((void**)&tags[count].tag, &tags[count].ok, gpr_time_0(GPR_CLOCK_MONOTONIC)) == CompletionQueue::GOT_EVENT)
+                {
+                    ++count;
+                }
             
-                gIncomingTagsMutex.lock();
-                gIncomingTags.push_back(tagInfo);
-                gIncomingTagsMutex.unlock();
+                mDispatchers[cq]->pushBatch(tags, count);
             }
         }
 
-        std::unique_ptr<ServerCompletionQueue> mCQ;
-        chatserver::ChatServer::AsyncService mChatServerService;
+        /** Poll a completion queue and process its tags right away on the polling thread.
+         * The tags are dispatched to their jobs' strands, which keeps each job's events in
+         * order. Saves the handoff to a worker thread. On the executor the strands queue the
+         * events for the workers instead of running them here.
+         * @param int cq: index of the completion queue to poll
+         */
+        void HandleRpcsInline(int cq)
+        {
+            TagInfo tagInfo;
+            // Next returns false once the queue is shut down and drained
+            while (mCQs[cq]->Next((void**)&tagInfo.tag, &tagInfo.ok))
+            {
+                processTag(tagInfo.tag, tagInfo.ok);
+            }
+        }
+
+        ServerOptions mOptions;
+        std::vector<std::unique_ptr<ServerCompletionQueue>> mCQs;
+        std::vector<std::unique_ptr<TagDispatcher>> mDispatchers;
+        std::unique_ptr<WorkStealingExecutor> mExecutor;
+        // Cpus of the pollers, worker threads and executor workers, empty when they float
+        std::vector<int> mPollerCpus;
+        std::vector<int> mDispatcherCpus;
+        std::vector<int> mWorkerCpus;
+        std::unique_ptr<SlotPool[]> mSlotPools; // RPC_METHOD_COUNT per completion queue
+        ChatServerService mChatServerService;
         std::unique_ptr<Server> mServer;
-        std::unordered_map<std::string, UserNode*> users_; 
+        std::atomic<bool> mShuttingDown; // No job is posted in place of the picked up ones anymore
+        std::chrono::steady_clock::time_point mShutdownStart;
+        // Handlers for different queues run concurrently, the core guards the users and
+        // mChatMutex guards the jobs on the chat.
+        ChatCore& mCore;
+        ListReplyCache mListCache;
+        std::mutex mChatMutex;
+        std::unordered_set<ChatMethod::Job*> mChatJobs; // Chat jobs picked up by a client
 
 };
 
-/** Loop to process tags, should be run in separate thread
+// Lets main() wake the stats thread up when the server stops
+static std::mutex gStatsMutex;
+static std::condition_variable gStatsCondition;
+static bool gStatsStopping = false;
+
+/** Periodically print the server counters until the server stops, should be run in separate thread
+ * @param int interval: seconds between reports
  */
-static void processRpcs()
+static void reportStats(int interval)
 {
-    // Implement a busy-wait loop. Not the most efficient thing in the world but but would do for this example
-    while (true)
+    std::unique_lock<std::mutex> lock(gStatsMutex);
+    while (!gStatsCondition.wait_for(lock, std::chrono::seconds(interval), []{ return gStatsStopping; }))
     {
-        gIncomingTagsMutex.lock();
-        TagList tags = std::move(gIncomingTags);
-        gIncomingTagsMutex.unlock();
-
-        while (!tags.empty())
-        {
-            TagInfo tagInfo = tags.front();
-            tags.pop_front();
-            (*(tagInfo.tagProcessor))(tagInfo.ok);
-        };
+        gEngine->printStats(std::cout);
     }
 }
 
+/** Wait for SIGINT or SIGTERM and shut the server down, should be run in separate thread
+ * @param sigset_t signals: the signals to wait for, blocked in every thread
+ */
+static void waitForShutdownSignal(sigset_t signals)
+{
+    int signal = 0;
+    sigwait(&signals, &signal);
+    std::cout << "Received signal " << signal << std::endl;
+    gEngine->Shutdown();
+}
 
-int main(int argc, char** argv) {
-  std::thread processorThread(processRpcs);
 
-  ServerImpl server;
-  gServerImpl = &server;
-  server.Run();
+int main(int argc, char** argv) {
+  ServerOptions options;
+  if (!parseServerOptions(argc, argv, options))
+  {
+      printServerUsage(argv[0]);
+      return 1;
+  }
+
+  // Block the shutdown signals before any thread starts so all of them inherit the mask
+  // and only the signal thread receives them
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  // Both engines serve the same users and mailboxes
+  ChatCore core(options.userShards, options.mailbox, options.presenceWindow, options.eviction);
+  std::cout << "User directory: " << core.directory().shardCount() << " shard(s)" << std::endl;
+  std::unique_ptr<ChatServerEngine> engine;
+  if (options.engine == ServerOptions::Engine::CALLBACK)
+  {
+      engine.reset(new CallbackServer(options, core));
+  }
+  else
+  {
+      gServerImpl = new ServerImpl(options, core);
+      engine.reset(gServerImpl);
+  }
+  gEngine = engine.get();
+  engine->Start();
+
+  std::thread signalThread(waitForShutdownSignal, signals);
+  signalThread.detach();
+
+  std::thread statsThread;
+  if (options.statsInterval > 0)
+      statsThread = std::thread(reportStats, options.statsInterval);
+
+  engine->Run();
+
+  if (statsThread.joinable())
+  {
+      {
+          std::lock_guard<std::mutex> lock(gStatsMutex);
+          gStatsStopping = true;
+      }
+      gStatsCondition.notify_one();
+      statsThread.join();
+  }
+
+  if (options.statsInterval > 0)
+      engine->printStats(std::cout);
 
   return 0;
 }
-
-
@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <utility>
+#include "ChatCore.hpp"
+#include "ChatServerGlobal.h"
+
+/** Function to check whether or not name chosen is valid name
+ * Name must contain only alphanumeric and no spaces
+ * @param const std::string& name: string to be checked
+ * @return bool: true if valid, false if not
+ */
+static bool isValid(const std::string& name)
+{
+    if(name == "")
+        return false;
+
+    for(size_t i = 0; i < name.length(); i++)
+    {
+        // letter must be A through z
+        if(name[i] < ALPHA_START || name[i] > ALPHA_END)
+            return false;
+    }
+    return true;
+}
+
+/** ChatCore Constructor
+ * @param size_t userShards: shards of the user directory, 0 picks one for the machine
+ * @param const MailboxPolicy& mailbox: size and overflow behavior of the users' mailboxes
+ * @param int presenceWindowMs: milliseconds the presence changes are gathered over before they are pushed
+ * @param const EvictionPolicy& eviction: when idle offline users are evicted
+ */
+ChatCore::ChatCore(size_t userShards, const MailboxPolicy& mailbox, int presenceWindowMs,
+                   const EvictionPolicy& eviction): mUsers(userShards, mailbox)
+                                                  , mPresenceFeed(mPresence, presenceWindowMs)
+                                                  , mSpilled(0)
+                                                  , mDroppedOldest(0)
+                                                  , mRejected(0)
+                                                  , mEvictor(*this, eviction){}
+
+/** Log a user in, creating it the first time its name is used
+ * @param const std::string& user: desired name
+ * @param uint32_t& id: where to store the id of the user on SUCCESS
+ * @return LogInReply::State: SUCCESS, or why the name can't be used, SERVER_OFF if
+ * a new user is needed and every id was handed out
+ */
+chatserver::LogInReply::State ChatCore::logIn(const std::string& user, uint32_t& id)
+{
+    // User's desired name is not valid
+    if(!isValid(user))
+        return chatserver::LogInReply::INVALID;
+
+    EpochGuard guard;
+    while(true)
+    {
+        UserNode* node = mUsers.insertIfAbsent(user).first;
+        // Ids are never reused, the server can't take new users anymore
+        if(!node)
+            return chatserver::LogInReply::SERVER_OFF;
+
+        node->touch();
+        if(mPresence.add(node))
+        {
+            // No one was online with that name
+            id = node->getId();
+            return chatserver::LogInReply::SUCCESS;
+        }
+
+        // Someone is currently online with that name
+        if(!node->isEvicted())
+            return chatserver::LogInReply::ALREADY;
+
+        // The user is being evicted, it is either gone or kept in a moment
+        std::this_thread::yield();
+    }
+}
+
+/** Set a user offline, its mailbox is kept
+ * @param uint32_t id: id of the user, 0 if the client only sent the name
+ * @param const std::string& user: name of the user
+ */
+void ChatCore::logOut(uint32_t id, const std::string& user)
+{
+    EpochGuard guard;
+    if(UserNode* node = lookUp(id, user))
+    {
+        node->touch();
+        mPresence.remove(node);
+    }
+}
+
+/** Format the list of online users
+ * @return std::string: the names in brackets
+ */
+std::string ChatCore::list()
+{
+    std::string list;
+    // Room for typical names, so the appends seldom reallocate
+    list.reserve(mPresence.size() * 16 + 2);
+    // Only the online users are visited
+    mPresence.forEach([&list](const UserNode& node)
+    {
+        // Format list of users
+        list.append(1, '[').append(node.getName()).append("] ");
+    });
+    list += "\n\n";
+    return list;
+}
+
+/** Fill a page of the online users, in name order
+ * @param const ListUsersRequest& request: prefix, limit and page token of the page
+ * @param ListUsersReply& reply: the reply to fill with the users and the next page token
+ */
+void ChatCore::listUsers(const chatserver::ListUsersRequest& request, chatserver::ListUsersReply& reply)
+{
+    uint32_t limit = request.limit() ? std::min(request.limit(), MAX_PAGE_SIZE) : DEFAULT_PAGE_SIZE;
+    bool more = mPresence.forEachByName(request.prefix(), request.pagetoken(), limit, [&reply](const UserNode& node)
+    {
+        chatserver::UserEntry* entry = reply.add_users();
+        entry->set_user(node.getName());
+        entry->set_userid(node.getId());
+    });
+
+    // The next page starts after the last name of this one
+    if(more)
+        reply.set_nextpagetoken(reply.users(reply.users_size() - 1).user());
+}
+
+/** Look a user up, by id when the client sent one
+ * @param uint32_t id: id of the user, 0 if the client only sent the name
+ * @param const std::string& user: name of the user, used if the id matches no one
+ * @return uint32_t: id of the user, UserIdTable::NO_ID if it never logged in or was evicted
+ */
+uint32_t ChatCore::findUser(uint32_t id, const std::string& user) const
+{
+    EpochGuard guard;
+    UserNode* node = lookUp(id, user);
+    return node ? node->getId() : UserIdTable::NO_ID;
+}
+
+/** Look a user up, by id when the client sent one. The caller holds an EpochGuard.
+ * @param uint32_t id: id of the user, 0 if the client only sent the name
+ * @param const std::string& user: name of the user, used if the id matches no one
+ * @return UserNode*: the user, nullptr if it never logged in or was evicted
+ */
+UserNode* ChatCore::lookUp(uint32_t id, const std::string& user) const
+{
+    // The id is an array index, the name needs hashing and a shard lock
+    if(UserNode* node = mUsers.find(id))
+        return node;
+
+    if(user.empty())
+        return nullptr;
+
+    return mUsers.find(user);
+}
+
+/** Name of a user for text shown to other clients
+ * @param uint32_t id: id of the user
+ * @param const std::string& user: name the client sent, if any
+ * @return std::string: the name sent, else the name of the user with that id, empty if there is none
+ */
+std::string ChatCore::nameOf(uint32_t id, const std::string& user) const
+{
+    if(!user.empty())
+        return user;
+
+    EpochGuard guard;
+    UserNode* node = mUsers.find(id);
+    return node ? node->getName() : std::string();
+}
+
+/** Queue a message in a user's mailbox
+ * @param uint32_t recipientId: id of the user, 0 if the client only sent the name
+ * @param const std::string& recipient: name of the user
+ * @param std::initializer_list<std::string_view> message: pieces of the message, written straight into the mailbox
+ * @param Mailbox::Result& result: where to store what the mailbox did with the message
+ * @return bool: false if there is no such user
+ */
+bool ChatCore::queueMessage(uint32_t recipientId, const std::string& recipient,
+                            std::initializer_list<std::string_view> message, Mailbox::Result& result)
+{
+    EpochGuard guard;
+    UserNode* node;
+    while(true)
+    {
+        node = lookUp(recipientId, recipient);
+        if(!node)
+            return false;
+        if(node->beginSend())
+            break;
+
+        // The user is being evicted, it is either gone or kept in a moment
+        std::this_thread::yield();
+    }
+
+    result = node->addMessage(message);
+    node->touch();
+    node->endSend();
+    if(result == Mailbox::Result::SPILLED)
+        mSpilled.fetch_add(1, std::memory_order_relaxed);
+    else if(result == Mailbox::Result::DROPPED_OLDEST)
+        mDroppedOldest.fetch_add(1, std::memory_order_relaxed);
+    else if(result == Mailbox::Result::REJECTED)
+        mRejected.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+/** Take the oldest messages out of a user's mailbox
+ * @param uint32_t id: id of the user, 0 if the client only sent the name
+ * @param const std::string& user: name of the user
+ * @param std::vector<std::string>& messages: replaced by the messages, oldest first
+ * @param size_t max: most messages to take
+ * @return size_t: number of messages taken, 0 once there is none left
+ */
+size_t ChatCore::takeMessages(uint32_t id, const std::string& user, std::vector<std::string>& messages, size_t max)
+{
+    EpochGuard guard;
+    UserNode* node = lookUp(id, user);
+    if(!node)
+    {
+        messages.clear();
+        return 0;
+    }
+
+    return node->getMessages(messages, max);
+}
+
+/** Push a user's mailbox to a ReceiveMessage stream, which replaces the one
+ * subscribed before. The user can't be evicted while it has a subscriber.
+ * @param uint32_t id: id of the user, 0 if the client only sent the name
+ * @param const std::string& user: name of the user
+ * @param std::shared_ptr<MailboxSubscriber> subscriber: the stream, it drains what is queued already itself
+ * @return bool: false if there is no such user
+ */
+bool ChatCore::subscribe(uint32_t id, const std::string& user, std::shared_ptr<MailboxSubscriber> subscriber)
+{
+    EpochGuard guard;
+    while(true)
+    {
+        UserNode* node = lookUp(id, user);
+        if(!node)
+            return false;
+
+        // Counted as a sender, so the evictor either sees the subscriber or the user is looked up again
+        if(node->beginSend())
+        {
+            node->subscribe(std::move(subscriber));
+            node->touch();
+            node->endSend();
+            return true;
+        }
+
+        // The user is being evicted, it is either gone or kept in a moment
+        std::this_thread::yield();
+    }
+}
+
+/** Stop pushing a user's mailbox to a stream, once the stream is done
+ * @param uint32_t id: id of the user, as given to subscribe()
+ * @param const std::string& user: name of the user, as given to subscribe()
+ * @param const MailboxSubscriber* subscriber: the stream, nothing happens if another one replaced it
+ */
+void ChatCore::unsubscribe(uint32_t id, const std::string& user, const MailboxSubscriber* subscriber)
+{
+    EpochGuard guard;
+    if(UserNode* node = lookUp(id, user))
+    {
+        node->unsubscribe(subscriber);
+        node->touch();
+    }
+}
+
+/** Count the messages waiting in the mailboxes
+ * @param size_t& messages: where to store the number of messages
+ * @param size_t& users: where to store the number of users with mail
+ */
+void ChatCore::countUnread(size_t& messages, size_t& users)
+{
+    messages = 0;
+    users = 0;
+    mUsers.forEach([&messages, &users](UserNode& node)
+    {
+        size_t count = node.getMessageCount();
+        messages += count;
+        users += (count > 0);
+    });
+}
+
+/** Accessor for the mailbox counters, adds up the memory of every mailbox
+ * @return MailboxStats: snapshot of the counters, each mailbox is read on its own
+ */
+MailboxStats ChatCore::getMailboxStats() const
+{
+    MailboxStats stats;
+    stats.spilled = mSpilled.load(std::memory_order_relaxed);
+    stats.droppedOldest = mDroppedOldest.load(std::memory_order_relaxed);
+    stats.rejected = mRejected.load(std::memory_order_relaxed);
+    stats.messages = 0;
+    stats.payloadBytes = 0;
+    stats.arenaBytes = 0;
+    stats.subscribers = 0;
+    mUsers.forEach([&stats](UserNode& node)
+    {
+        stats.subscribers += node.hasSubscriber();
+        const Mailbox& mailbox = node.getMailbox();
+        stats.messages += mailbox.size();
+        stats.payloadBytes += mailbox.payloadBytes();
+        stats.arenaBytes += mailbox.arenaBytes();
+    });
+    return stats;
+}
+
+/** Evict the offline users with an empty mailbox that the policy lets go: those
+ * idle past the timeout, then the least recently active while there are more
+ * users than the cap. A user is only removed if it stayed idle, offline and
+ * without mail up to the moment it goes, the nodes are freed later on.
+ * @param const EvictionPolicy& policy: timeout and cap of the users
+ * @return size_t: number of users evicted
+ */
+size_t ChatCore::evictIdleUsers(const EvictionPolicy& policy)
+{
+    // The candidates stay valid whoever removes them meanwhile
+    EpochGuard guard;
+    std::vector<std::pair<int64_t, UserNode*>> candidates;
+    size_t users = 0;
+    mUsers.forEach([&candidates, &users](UserNode& node)
+    {
+        users++;
+        if(!node.getOnline() && node.getMessageCount() == 0)
+            candidates.emplace_back(node.getLastActive(), &node);
+    });
+    // Least recently active first
+    std::sort(candidates.begin(), candidates.end());
+
+    int64_t idleBefore = (policy.idleTimeout > 0) ? UserNode::nowMs() - policy.idleTimeout * 1000ll : std::numeric_limits<int64_t>::min();
+    size_t evicted = 0;
+    for(const std::pair<int64_t, UserNode*>& candidate : candidates)
+    {
+        // Every user after this one is more recent, so neither idle nor needed under the cap
+        if(candidate.first >= idleBefore && (policy.maxUsers == 0 || users - evicted <= policy.maxUsers))
+            break;
+
+        bool removed = mUsers.erase(candidate.second, [this, &candidate](UserNode& node)
+        {
+            // Active since it was picked, or about to log in or be told about
+            if(node.getLastActive() != candidate.first || !mPresence.evict(&node))
+                return false;
+            // A message got in meanwhile, the sender saw the user before it was marked
+            if(!node.canReclaim())
+            {
+                mPresence.restore(&node);
+                return false;
+            }
+            return true;
+        });
+        evicted += removed;
+    }
+    return evicted;
+}
+
+/** Accessor for the eviction counters and the memory of the process
+ * @return EvictionStats: snapshot of the counters
+ */
+EvictionStats ChatCore::getEvictionStats() const
+{
+    return mEvictor.getStats();
+}
+
+/** Count the online users
+ * @return size_t: number of users online
+ */
+size_t ChatCore::onlineCount() const
+{
+    return mPresence.size();
+}
+
+/** Accessor for the version of the online users, changes with every login and logout
+ * @return uint64_t: the version, read before list() it tags what list() returns
+ */
+uint64_t ChatCore::presenceVersion() const
+{
+    return mPresence.version();
+}
+
+/** Accessor for the user directory
+ * @return const UserDirectory&: the users
+ */
+const UserDirectory& ChatCore::directory() const
+{
+    return mUsers;
+}
+
+/** Accessor for the feed pushing the presence changes to the WatchPresence streams
+ * @return PresenceFeed&: the feed
+ */
+PresenceFeed& ChatCore::presenceFeed()
+{
+    return mPresenceFeed;
+}
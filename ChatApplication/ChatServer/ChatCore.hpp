@@ -0,0 +1,73 @@
+#ifndef CHAT_CORE_H
+#define CHAT_CORE_H
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "chatserver.pb.h"
+#include "Mailbox.hpp"
+#include "PresenceFeed.hpp"
+#include "PresenceIndex.hpp"
+#include "UserDirectory.hpp"
+#include "UserEvictor.hpp"
+#include "UserNode.hpp"
+
+/** The users and their mailboxes, shared by the server engines. Every method
+ * can be called from any thread. Users are named either by the id LogIn gave
+ * them or by name for clients that don't send ids, the id is tried first.
+ * Offline users with an empty mailbox are evicted once idle, they get a new id
+ * when they log in again. The nodes never leave ChatCore, so that every access
+ * to them can hold an EpochGuard.
+ */
+class ChatCore
+{
+    public:
+
+        static constexpr uint32_t DEFAULT_PAGE_SIZE = 100; // Users in a ListUsers page when the client sets no limit
+        static constexpr uint32_t MAX_PAGE_SIZE = 1000;    // Most users in a ListUsers page
+
+        explicit ChatCore(size_t userShards = 0, const MailboxPolicy& mailbox = MailboxPolicy(),
+                          int presenceWindowMs = PresenceFeed::DEFAULT_WINDOW_MS,
+                          const EvictionPolicy& eviction = EvictionPolicy());
+
+        ChatCore(const ChatCore&) = delete;
+        ChatCore& operator=(const ChatCore&) = delete;
+
+        chatserver::LogInReply::State logIn(const std::string& user, uint32_t& id);
+        void logOut(uint32_t id, const std::string& user);
+        std::string list();
+        void listUsers(const chatserver::ListUsersRequest& request, chatserver::ListUsersReply& reply);
+        uint32_t findUser(uint32_t id, const std::string& user) const;
+        std::string nameOf(uint32_t id, const std::string& user) const;
+        bool queueMessage(uint32_t recipientId, const std::string& recipient,
+                          std::initializer_list<std::string_view> message, Mailbox::Result& result);
+        size_t takeMessages(uint32_t id, const std::string& user, std::vector<std::string>& messages, size_t max);
+        bool subscribe(uint32_t id, const std::string& user, std::shared_ptr<MailboxSubscriber> subscriber);
+        void unsubscribe(uint32_t id, const std::string& user, const MailboxSubscriber* subscriber);
+        void countUnread(size_t& messages, size_t& users);
+        MailboxStats getMailboxStats() const;
+        size_t evictIdleUsers(const EvictionPolicy& policy);
+        EvictionStats getEvictionStats() const;
+        size_t onlineCount() const;
+        uint64_t presenceVersion() const;
+        const UserDirectory& directory() const;
+        PresenceFeed& presenceFeed();
+
+    private:
+
+        UserNode* lookUp(uint32_t id, const std::string& user) const;
+
+        UserDirectory mUsers;
+        PresenceIndex mPresence;
+        PresenceFeed mPresenceFeed; // After mPresence, its thread reads it until the feed is gone
+        std::atomic<uint64_t> mSpilled;
+        std::atomic<uint64_t> mDroppedOldest;
+        std::atomic<uint64_t> mRejected;
+        UserEvictor mEvictor; // Last, its thread uses everything above
+};
+
+#endif
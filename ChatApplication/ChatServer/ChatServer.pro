@@ -12,7 +12,7 @@ QMAKE_CXXFLAGS += -L/usr/local/lib `pkg-config --libs grpc++ grpc`  \
                   `pkg-config --libs protobuf` \
                   -Wl,--no-as-needed -lgrpc++_reflection -Wl,--as-needed \
                   -lprotobuf -lpthread\
-                  -std=c++11\
+                  -std=c++20\
                   -I/usr/local/include -pthread\
                   -Wall -g
 
@@ -96,9 +96,47 @@ DEPENDPATH += $$PWD/../../../grpc/libs/opt
 
 SOURCES += \
     UserNode.cpp \
+    EpochReclaimer.cpp \
+    UserDirectory.cpp \
+    UserIdTable.cpp \
+    Mailbox.cpp \
+    MessageArena.cpp \
+    PresenceIndex.cpp \
+    PresenceFeed.cpp \
+    ListReplyCache.cpp \
+    FlatUserTable.cpp \
+    UserEvictor.cpp \
+    ChatCore.cpp \
+    CallbackServer.cpp \
+    CpuTopology.cpp \
+    TagDispatcher.cpp \
+    ServerOptions.cpp \
+    WorkStealingExecutor.cpp \
+    Strand.cpp \
     ChatAppServer.cpp
 
 HEADERS += \
     UserNode.hpp \
+    EpochReclaimer.hpp \
+    UserDirectory.hpp \
+    UserIdTable.hpp \
+    Mailbox.hpp \
+    MessageArena.hpp \
+    PresenceIndex.hpp \
+    PresenceFeed.hpp \
+    ListReplyCache.hpp \
+    FlatUserTable.hpp \
+    UserEvictor.hpp \
+    ChatCore.hpp \
+    ChatServerEngine.hpp \
+    CallbackServer.hpp \
+    CpuTopology.hpp \
+    TagDispatcher.hpp \
+    MpscQueue.hpp \
+    ServerOptions.hpp \
+    WorkStealingExecutor.hpp \
+    JobPool.hpp \
+    RpcCoroutine.hpp \
+    Strand.hpp \
     ChatServerGlobal.h
 
@@ -0,0 +1,24 @@
+#ifndef CHAT_SERVER_ENGINE_H
+#define CHAT_SERVER_ENGINE_H
+
+#include <iostream>
+
+/** A way of serving the ChatServer service on top of the ChatCore. main()
+ * starts the engine chosen with --engine and drives it through this.
+ */
+class ChatServerEngine
+{
+    public:
+
+        virtual ~ChatServerEngine(){}
+
+        // Build the server and start listening
+        virtual void Start() = 0;
+        // Serve rpcs until Shutdown() is done
+        virtual void Run() = 0;
+        // Stop accepting rpcs and drain the in-flight ones, can be called from any thread
+        virtual void Shutdown() = 0;
+        virtual void printStats(std::ostream& out) = 0;
+};
+
+#endif
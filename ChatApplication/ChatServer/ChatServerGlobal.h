@@ -27,6 +27,8 @@ static const std::string SEND_MESSAGE_NO_EXIST = "The user does not exist.\n\n";
 
 static const std::string SEND_MESSAGE_CONFIRM = "All messages have been sent to ";
 
+static const std::string SEND_MESSAGE_MAILBOX_FULL = "The mailbox of the user is full, the message was not delivered.\n\n";
+
 static const std::string SEND_MESSAGE_DONE = "SendMessage RPC finished.\n\n";
 
 static const std::string SEND_MESSAGE_FAIL = "SendMessage RPC failed.\n\n";
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <tuple>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include "CpuTopology.hpp"
+
+/** Read a number from a sysfs file
+ * @param const std::string& path: file to read
+ * @param int fallback: value to use if the file is missing or unreadable
+ * @return int: the number in the file
+ */
+static int readSysfsNumber(const std::string& path, int fallback)
+{
+    std::ifstream file(path);
+    int value;
+    if(!(file >> value))
+        return fallback;
+    return value;
+}
+
+/** Parse a sysfs cpu list such as "0-3,8-11"
+ * @param const std::string& list: text to parse
+ * @return std::vector<int>: the cpus in the list
+ */
+static std::vector<int> parseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    const char* text = list.c_str();
+    while(*text)
+    {
+        char* end = nullptr;
+        long first = std::strtol(text, &end, 10);
+        if(end == text)
+            break;
+        long last = first;
+        if(*end == '-')
+        {
+            text = end + 1;
+            last = std::strtol(text, &end, 10);
+        }
+        for(long cpu = first; cpu <= last; cpu++)
+            cpus.push_back((int)cpu);
+        text = (*end == ',') ? end + 1 : end;
+    }
+    return cpus;
+}
+
+/** Find the NUMA node of every cpu
+ * @return std::map<int, int>: node of each cpu, empty without NUMA support
+ */
+static std::map<int, int> readCpuNodes()
+{
+    std::map<int, int> nodes;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if(!dir)
+        return nodes;
+
+    while(dirent* entry = readdir(dir))
+    {
+        int node;
+        char extra;
+        if(std::sscanf(entry->d_name, "node%d%c", &node, &extra) != 1)
+            continue;
+
+        std::ifstream file(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+        std::string list;
+        std::getline(file, list);
+        for(int cpu : parseCpuList(list))
+            nodes[cpu] = node;
+    }
+    closedir(dir);
+    return nodes;
+}
+
+/** CpuTopology Constructor
+ */
+CpuTopology::CpuTopology(): mNodes(0)
+                          , mNext(0){}
+
+/** Read the topology of the cpus the process is allowed to run on
+ * @return CpuTopology: the topology, ready to hand out cpus
+ */
+CpuTopology CpuTopology::detect()
+{
+    CpuTopology topology;
+
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return topology;
+
+    std::map<int, int> nodes = readCpuNodes();
+    std::map<std::pair<int, int>, int> coreThreads;
+    std::set<int> distinctNodes;
+    for(int id = 0; id < CPU_SETSIZE; id++)
+    {
+        if(!CPU_ISSET(id, &allowed))
+            continue;
+
+        std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+        Cpu cpu;
+        cpu.id = id;
+        cpu.node = nodes.count(id) ? nodes[id] : 0;
+        cpu.package = readSysfsNumber(path + "physical_package_id", 0);
+        cpu.core = readSysfsNumber(path + "core_id", id);
+        cpu.sibling = coreThreads[std::make_pair(cpu.package, cpu.core)]++;
+        topology.mCpus.push_back(cpu);
+        distinctNodes.insert(cpu.node);
+    }
+    topology.mNodes = (int)distinctNodes.size();
+
+    std::sort(topology.mCpus.begin(), topology.mCpus.end(), [](const Cpu& a, const Cpu& b)
+    {
+        return std::tie(a.node, a.sibling, a.package, a.core, a.id)
+             < std::tie(b.node, b.sibling, b.package, b.core, b.id);
+    });
+    return topology;
+}
+
+/** Accessor for the cpus
+ * @return const std::vector<Cpu>&: the allowed cpus in the order they are handed out
+ */
+const std::vector<CpuTopology::Cpu>& CpuTopology::cpus() const
+{
+    return mCpus;
+}
+
+/** Accessor for the number of NUMA nodes the allowed cpus are on
+ * @return int: number of nodes
+ */
+int CpuTopology::nodes() const
+{
+    return mNodes;
+}
+
+/** Hand out the cpu for the next thread, starting over once every cpu has one
+ * @return const Cpu&: the cpu
+ */
+const CpuTopology::Cpu& CpuTopology::next()
+{
+    return mCpus[mNext++ % mCpus.size()];
+}
+
+/** Print the cpus of each node
+ * @param std::ostream& out: stream to print to
+ * @param const CpuTopology& topology: topology to print
+ * @return std::ostream&: the stream printed to
+ */
+std::ostream& operator<<(std::ostream& out, const CpuTopology& topology)
+{
+    std::map<int, std::vector<int>> nodeCpus;
+    for(const CpuTopology::Cpu& cpu : topology.cpus())
+        nodeCpus[cpu.node].push_back(cpu.id);
+
+    out << topology.cpus().size() << " cpu(s) on " << topology.nodes() << " NUMA node(s)";
+    for(auto& node : nodeCpus)
+    {
+        std::sort(node.second.begin(), node.second.end());
+        out << "\n  node " << node.first << ": cpus";
+        for(int cpu : node.second)
+            out << " " << cpu;
+    }
+    return out;
+}
+
+/** Restrict the calling thread to one cpu
+ * @param int cpu: cpu to run on
+ * @return bool: true if the thread is pinned, false if the kernel refused
+ */
+bool pinCurrentThread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,66 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/** The cpus the server may run on and the NUMA node and core each of them
+ * belongs to, read from sysfs. Hands the cpus out to the server threads one
+ * by one: a core of each node before its hyperthread siblings, and a whole
+ * node before the next one, so threads started one after the other share a
+ * node and its memory.
+ */
+class CpuTopology
+{
+    public:
+
+        struct Cpu
+        {
+            int id;      // Number the kernel knows the cpu by
+            int node;    // NUMA node, 0 on machines without NUMA
+            int package; // Physical socket
+            int core;    // Core in the socket, shared by hyperthread siblings
+            int sibling; // Position among the hyperthreads of the core
+        };
+
+        static CpuTopology detect();
+
+        const std::vector<Cpu>& cpus() const;
+        int nodes() const;
+        const Cpu& next();
+
+    private:
+
+        CpuTopology();
+
+        std::vector<Cpu> mCpus; // Ordered the way they are handed out
+        int mNodes;
+        size_t mNext;
+};
+
+std::ostream& operator<<(std::ostream& out, const CpuTopology& topology);
+
+bool pinCurrentThread(int cpu);
+
+/** Run a function on a thread of its own pinned to a cpu and wait for it. The
+ * kernel backs memory with pages of the node that first touches it and the
+ * new thread gets a fresh malloc arena, so what the function allocates ends
+ * up local to that cpu.
+ * @param int cpu: cpu to run the function on
+ * @param Function&& function: callable taking no arguments
+ */
+template<typename Function>
+void runOnCpu(int cpu, Function&& function)
+{
+    std::thread thread([cpu, &function]
+    {
+        pinCurrentThread(cpu);
+        function();
+    });
+    thread.join();
+}
+
+#endif
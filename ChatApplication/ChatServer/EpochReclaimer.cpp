@@ -0,0 +1,156 @@
+#include <algorithm>
+#include "EpochReclaimer.hpp"
+
+thread_local EpochReclaimer::ThreadRecord EpochReclaimer::tRecord;
+
+/** EpochReclaimer Constructor, no thread has entered yet
+ */
+EpochReclaimer::EpochReclaimer(): mEpoch(1)
+                                , mParticipants(nullptr)
+                                , mParticipantCount(0)
+                                , mFreed(0){}
+
+/** EpochReclaimer Destructor, runs at exit and frees whatever is still retired.
+ * The records stay, threads may still exit after it.
+ */
+EpochReclaimer::~EpochReclaimer()
+{
+    for(const Retired& retired : mRetired)
+        retired.destroy(retired.object);
+}
+
+/** ThreadRecord Destructor, leaves the record to the next thread
+ */
+EpochReclaimer::ThreadRecord::~ThreadRecord()
+{
+    if(participant)
+        participant->taken.store(false, std::memory_order_release);
+}
+
+/** Get the record of the calling thread, taking a free one or adding one the first time
+ * @return Participant*: the thread's record
+ */
+EpochReclaimer::Participant* EpochReclaimer::participant()
+{
+    if(tRecord.participant)
+        return tRecord.participant;
+
+    Participant* participant;
+    for(participant = mParticipants.load(std::memory_order_acquire); participant; participant = participant->next)
+    {
+        bool taken = false;
+        if(!participant->taken.load(std::memory_order_relaxed)
+           && participant->taken.compare_exchange_strong(taken, true, std::memory_order_acquire))
+            break;
+    }
+
+    if(!participant)
+    {
+        participant = new Participant();
+        participant->epoch.store(QUIESCENT, std::memory_order_relaxed);
+        participant->taken.store(true, std::memory_order_relaxed);
+        participant->depth = 0;
+        participant->next = mParticipants.load(std::memory_order_relaxed);
+        while(!mParticipants.compare_exchange_weak(participant->next, participant, std::memory_order_release))
+            ;
+        mParticipantCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    tRecord.participant = participant;
+    return participant;
+}
+
+/** Enter a critical section, announcing the current epoch
+ */
+void EpochReclaimer::enter()
+{
+    Participant* self = participant();
+    if(self->depth++ > 0)
+        return;
+
+    // Reading the epoch an object was retired after means seeing it unlinked. The fence keeps
+    // the reads of the section after the announcement, which reclaim() is sure to see then.
+    self->epoch.store(mEpoch.load(std::memory_order_acquire), std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+/** Leave a critical section, the objects found in it can't be used anymore
+ */
+void EpochReclaimer::leave()
+{
+    Participant* self = tRecord.participant;
+    if(--self->depth == 0)
+        self->epoch.store(QUIESCENT, std::memory_order_release);
+}
+
+/** Keep an unlinked object until it can be freed
+ * @param void* object: the object
+ * @param void (*destroy)(void*): frees the object
+ */
+void EpochReclaimer::retire(void* object, void (*destroy)(void*))
+{
+    // Readers entering from now on announce a later epoch and can't find the object
+    uint64_t epoch = mEpoch.fetch_add(1, std::memory_order_seq_cst);
+    std::lock_guard<std::mutex> lock(mMutex);
+    mRetired.push_back(Retired{object, destroy, epoch});
+}
+
+/** Free the retired objects no reader can still hold, those retired before
+ * the oldest epoch announced
+ * @return size_t: number of objects freed
+ */
+size_t EpochReclaimer::reclaim()
+{
+    std::vector<Retired> ready;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mRetired.empty())
+            return 0;
+
+        uint64_t oldest = mEpoch.load(std::memory_order_seq_cst);
+        for(Participant* participant = mParticipants.load(std::memory_order_acquire); participant; participant = participant->next)
+        {
+            uint64_t epoch = participant->epoch.load(std::memory_order_seq_cst);
+            if(epoch != QUIESCENT)
+                oldest = std::min(oldest, epoch);
+        }
+
+        auto kept = std::partition(mRetired.begin(), mRetired.end(),
+                                   [oldest](const Retired& retired) { return retired.epoch >= oldest; });
+        ready.assign(kept, mRetired.end());
+        mRetired.erase(kept, mRetired.end());
+    }
+
+    for(const Retired& retired : ready)
+        retired.destroy(retired.object);
+    mFreed.fetch_add(ready.size(), std::memory_order_relaxed);
+    return ready.size();
+}
+
+/** Accessor for the reclaimer counters
+ * @return EpochReclaimerStats: snapshot of the counters
+ */
+EpochReclaimerStats EpochReclaimer::getStats() const
+{
+    EpochReclaimerStats stats;
+    stats.epoch = mEpoch.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        stats.pending = mRetired.size();
+    }
+    stats.freed = mFreed.load(std::memory_order_relaxed);
+    stats.participants = mParticipantCount.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/** Print the reclaimer counters
+ * @param std::ostream& out: stream to print to
+ * @param const EpochReclaimerStats& stats: counters to print
+ * @return std::ostream&: the stream printed to
+ */
+std::ostream& operator<<(std::ostream& out, const EpochReclaimerStats& stats)
+{
+    out << "epoch=" << stats.epoch << " pendingFree=" << stats.pending << " freed=" << stats.freed
+        << " participants=" << stats.participants;
+    return out;
+}
@@ -0,0 +1,130 @@
+#ifndef EPOCH_RECLAIMER_H
+#define EPOCH_RECLAIMER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+/** Counters of the EpochReclaimer
+ */
+struct EpochReclaimerStats
+{
+    uint64_t epoch;      // Current epoch, moves on with every retired object
+    size_t pending;      // Objects retired but not freed yet
+    uint64_t freed;      // Objects freed so far
+    size_t participants; // Threads that ever entered, their records are reused
+};
+
+std::ostream& operator<<(std::ostream& out, const EpochReclaimerStats& stats);
+
+/** Epoch-based reclamation of objects other threads may still be reading
+ * without a lock, the UserNodes removed from the directory. Readers enter a
+ * critical section with an EpochGuard, which announces the epoch they started
+ * in. Whoever unlinks an object retires it, moving the epoch on, and reclaim()
+ * frees the objects retired before the oldest epoch still announced. A reader
+ * can thus use anything it found inside its guard until the guard ends.
+ * Entering and leaving only touch the thread's own record.
+ */
+class EpochReclaimer
+{
+    public:
+
+        /** Accessor for the reclaimer shared by the whole server
+         * @return EpochReclaimer&: the reclaimer
+         */
+        static EpochReclaimer& instance()
+        {
+            static EpochReclaimer reclaimer;
+            return reclaimer;
+        }
+
+        ~EpochReclaimer();
+
+        EpochReclaimer(const EpochReclaimer&) = delete;
+        EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+        void enter();
+        void leave();
+        template<typename T>
+        void retire(T* object);
+        size_t reclaim();
+        EpochReclaimerStats getStats() const;
+
+    private:
+
+        static const uint64_t QUIESCENT = 0; // Announced by threads outside any guard, epochs start at 1
+
+        // A thread's announced epoch, on a cache line of its own
+        struct alignas(64) Participant
+        {
+            std::atomic<uint64_t> epoch;
+            std::atomic<bool> taken; // Owned by a live thread
+            unsigned depth;          // Guards the owner is nested in, only touched by the owner
+            Participant* next;
+        };
+
+        // Gives the thread's record back when the thread exits
+        struct ThreadRecord
+        {
+            Participant* participant = nullptr;
+            ~ThreadRecord();
+        };
+
+        struct Retired
+        {
+            void* object;
+            void (*destroy)(void*);
+            uint64_t epoch; // Epoch the object was unlinked in
+        };
+
+        EpochReclaimer();
+
+        Participant* participant();
+        void retire(void* object, void (*destroy)(void*));
+
+        static thread_local ThreadRecord tRecord;
+
+        std::atomic<uint64_t> mEpoch;
+        std::atomic<Participant*> mParticipants; // Never shrinks, records are kept for the next thread
+        std::atomic<size_t> mParticipantCount;
+
+        mutable std::mutex mMutex; // Guards mRetired
+        std::vector<Retired> mRetired;
+        std::atomic<uint64_t> mFreed;
+};
+
+/** Hand an object to the reclaimer once no new reader can find it, it is
+ * deleted once the readers that might have found it are gone
+ * @param T* object: object to delete, unlinked already
+ */
+template<typename T>
+void EpochReclaimer::retire(T* object)
+{
+    retire(object, [](void* retired) { delete static_cast<T*>(retired); });
+}
+
+/** Critical section of a reader, the objects it finds stay valid until it ends.
+ * Guards nest.
+ */
+class EpochGuard
+{
+    public:
+
+        EpochGuard()
+        {
+            EpochReclaimer::instance().enter();
+        }
+
+        ~EpochGuard()
+        {
+            EpochReclaimer::instance().leave();
+        }
+
+        EpochGuard(const EpochGuard&) = delete;
+        EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "FlatUserTable.hpp"
+
+/** FlatUserTable Constructor, starts with a single group
+ */
+FlatUserTable::FlatUserTable(): mControl(new uint8_t[GROUP_SIZE])
+                              , mSlots(new Slot[GROUP_SIZE])
+                              , mCapacity(GROUP_SIZE)
+                              , mSize(0)
+                              , mDeleted(0)
+{
+    std::memset(mControl.get(), EMPTY, mCapacity);
+}
+
+/** Find the slots of a group whose control byte is a given value
+ * @param size_t group: index of the group
+ * @param uint8_t control: control byte to look for
+ * @return uint32_t: bit i is set if slot i of the group matches
+ */
+uint32_t FlatUserTable::matchGroup(size_t group, uint8_t control) const
+{
+    const uint8_t* bytes = mControl.get() + group * GROUP_SIZE;
+#ifdef __SSE2__
+    __m128i controls = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(controls, _mm_set1_epi8((char)control)));
+#else
+    uint32_t matches = 0;
+    for(size_t i = 0; i < GROUP_SIZE; i++)
+        matches |= (uint32_t)(bytes[i] == control) << i;
+    return matches;
+#endif
+}
+
+/** Check whether a slot holds a user
+ * @param const Slot& slot: full slot whose control byte matched
+ * @param const std::string& name: name of the user
+ * @param uint64_t hash: hash of the name
+ * @return bool: true if the slot holds that user
+ */
+bool FlatUserTable::slotMatches(const Slot& slot, const std::string& name, uint64_t hash) const
+{
+    if(slot.hash != hash)
+        return false;
+
+    if(name.size() <= INLINE_NAME_LENGTH)
+        return slot.length == name.size() && std::memcmp(slot.name, name.data(), name.size()) == 0;
+
+    // Too long to be inline, the node has it
+    return slot.length > INLINE_NAME_LENGTH && slot.node->getName() == name;
+}
+
+/** Look a user up
+ * @param const std::string& name: name of the user
+ * @param uint64_t hash: hash of the name
+ * @return UserNode*: the user, nullptr if it is not in the table
+ */
+UserNode* FlatUserTable::find(const std::string& name, uint64_t hash) const
+{
+    size_t index = findSlot(name, hash);
+    return (index == mCapacity) ? nullptr : mSlots[index].node;
+}
+
+/** Find the slot of a user
+ * @param const std::string& name: name of the user
+ * @param uint64_t hash: hash of the name
+ * @return size_t: index of the slot, mCapacity if the user is not in the table
+ */
+size_t FlatUserTable::findSlot(const std::string& name, uint64_t hash) const
+{
+    uint8_t control = controlOf(hash);
+    size_t groupMask = mCapacity / GROUP_SIZE - 1;
+    size_t group = firstGroup(hash);
+    // Triangular probing visits every group once, and the load factor keeps an empty slot in some group
+    for(size_t probe = 1; ; probe++)
+    {
+        for(uint32_t matches = matchGroup(group, control); matches; matches &= matches - 1)
+        {
+            size_t index = group * GROUP_SIZE + __builtin_ctz(matches);
+            if(slotMatches(mSlots[index], name, hash))
+                return index;
+        }
+
+        // A user is never placed past an empty slot of its probe sequence
+        if(matchGroup(group, EMPTY))
+            return mCapacity;
+
+        group = (group + probe) & groupMask;
+    }
+}
+
+/** Add a user unless one with that name is in the table
+ * @param const std::string& name: name of the user
+ * @param uint64_t hash: hash of the name
+ * @param UserNode* node: the user to add
+ * @return UserNode*: the user in the table, node if it was added
+ */
+UserNode* FlatUserTable::insert(const std::string& name, uint64_t hash, UserNode* node)
+{
+    if(UserNode* existing = find(name, hash))
+        return existing;
+
+    // Keep at most 7 slots in 8 full or tombstones
+    if((mSize + mDeleted + 1) * 8 > mCapacity * 7)
+        rehash();
+
+    Slot& slot = mSlots[claim(hash)];
+    slot.hash = hash;
+    slot.node = node;
+    slot.length = (uint8_t)std::min<size_t>(name.size(), 255);
+    if(name.size() <= INLINE_NAME_LENGTH)
+        std::memcpy(slot.name, name.data(), name.size());
+    mSize++;
+    return node;
+}
+
+/** Remove a user
+ * @param const std::string& name: name of the user
+ * @param uint64_t hash: hash of the name
+ * @return bool: false if the user is not in the table
+ */
+bool FlatUserTable::erase(const std::string& name, uint64_t hash)
+{
+    size_t index = findSlot(name, hash);
+    if(index == mCapacity)
+        return false;
+
+    // A group with an empty slot never filled up since the last rehash, so no probe went past it
+    if(matchGroup(index / GROUP_SIZE, EMPTY))
+    {
+        mControl[index] = EMPTY;
+    }
+    else
+    {
+        mControl[index] = DELETED;
+        mDeleted++;
+    }
+    mSize--;
+
+    // Give the memory back once the table is mostly empty
+    if(mCapacity > GROUP_SIZE && mSize * 8 < mCapacity)
+        rehash();
+    return true;
+}
+
+/** Take the first free slot of the probe sequence of a hash, empty or tombstone
+ * @param uint64_t hash: hash of the name to put in the slot
+ * @return size_t: index of the slot, its control byte is set already
+ */
+size_t FlatUserTable::claim(uint64_t hash)
+{
+    size_t groupMask = mCapacity / GROUP_SIZE - 1;
+    size_t group = firstGroup(hash);
+    uint32_t free;
+    for(size_t probe = 1; !(free = matchGroup(group, EMPTY) | matchGroup(group, DELETED)); probe++)
+        group = (group + probe) & groupMask;
+
+    size_t index = group * GROUP_SIZE + __builtin_ctz(free);
+    if(mControl[index] == DELETED)
+        mDeleted--;
+    mControl[index] = controlOf(hash);
+    return index;
+}
+
+/** Put every user in a table sized for them, at most 7 slots in 16 full,
+ * which drops the tombstones and grows or shrinks the table
+ */
+void FlatUserTable::rehash()
+{
+    std::unique_ptr<uint8_t[]> oldControl(std::move(mControl));
+    std::unique_ptr<Slot[]> oldSlots(std::move(mSlots));
+    size_t oldCapacity = mCapacity;
+
+    mCapacity = GROUP_SIZE;
+    while((mSize + 1) * 16 > mCapacity * 7)
+        mCapacity *= 2;
+    mDeleted = 0;
+    mControl.reset(new uint8_t[mCapacity]);
+    mSlots.reset(new Slot[mCapacity]);
+    std::memset(mControl.get(), EMPTY, mCapacity);
+
+    for(size_t i = 0; i < oldCapacity; i++)
+    {
+        if(!isFull(oldControl[i]))
+            continue;
+
+        // The slot keeps the hash, nothing needs to be hashed again
+        mSlots[claim(oldSlots[i].hash)] = oldSlots[i];
+    }
+}
+
+/** Accessor for the number of users
+ * @return size_t: users in the table
+ */
+size_t FlatUserTable::size() const
+{
+    return mSize;
+}
+
+/** Accessor for the number of slots
+ * @return size_t: slots in the table, full or not
+ */
+size_t FlatUserTable::capacity() const
+{
+    return mCapacity;
+}
+
+/** Bytes taken by the table itself, not counting the nodes
+ * @return size_t: size of the control bytes and the slots
+ */
+size_t FlatUserTable::memoryUsage() const
+{
+    return mCapacity * (1 + sizeof(Slot));
+}
@@ -0,0 +1,97 @@
+#ifndef FLAT_USER_TABLE_H
+#define FLAT_USER_TABLE_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include "UserNode.hpp"
+
+/** Open-addressing hash table from user name to UserNode, laid out like a
+ * Swiss table: a byte of control per slot holding 7 bits of the hash, probed
+ * GROUP_SIZE slots at a time (with SSE2 when available), and slots keeping the
+ * full hash, the node and names of up to INLINE_NAME_LENGTH characters inline,
+ * all in one array. A lookup touches the control group and one slot, the node
+ * is only read for longer names. Not synchronized, UserDirectory locks it.
+ * A removed user leaves a tombstone, unless its group never filled up and so
+ * never made a probe go on, and the tombstones go when the table is rehashed.
+ * The table also shrinks once it is mostly empty.
+ */
+class FlatUserTable
+{
+    public:
+
+        static const size_t GROUP_SIZE = 16;
+        static const size_t INLINE_NAME_LENGTH = 15;
+
+        FlatUserTable();
+
+        FlatUserTable(const FlatUserTable&) = delete;
+        FlatUserTable& operator=(const FlatUserTable&) = delete;
+
+        UserNode* find(const std::string& name, uint64_t hash) const;
+        UserNode* insert(const std::string& name, uint64_t hash, UserNode* node);
+        bool erase(const std::string& name, uint64_t hash);
+
+        /** Call a function on every user
+         * @param Function&& function: callable taking a UserNode*
+         */
+        template<typename Function>
+        void forEach(Function&& function) const
+        {
+            for(size_t i = 0; i < mCapacity; i++)
+            {
+                if(isFull(mControl[i]))
+                    function(mSlots[i].node);
+            }
+        }
+
+        size_t size() const;
+        size_t capacity() const;
+        size_t memoryUsage() const;
+
+    private:
+
+        static const uint8_t EMPTY = 0x80;   // Full slots have the top bit clear
+        static const uint8_t DELETED = 0xFE; // Tombstone, probes go on past it
+
+        // 32 bytes, two to a cache line
+        struct Slot
+        {
+            uint64_t hash;
+            UserNode* node;
+            uint8_t length;                  // Length of the name, stored inline if it fits
+            char name[INLINE_NAME_LENGTH];
+        };
+
+        static bool isFull(uint8_t control)
+        {
+            return (control & EMPTY) == 0;
+        }
+
+        // Part of the hash kept in the control byte
+        static uint8_t controlOf(uint64_t hash)
+        {
+            return hash & 0x7F;
+        }
+
+        // Group the probe for a hash starts at, from the bits the control byte leaves out
+        size_t firstGroup(uint64_t hash) const
+        {
+            return (hash >> 7) & (mCapacity / GROUP_SIZE - 1);
+        }
+
+        uint32_t matchGroup(size_t group, uint8_t control) const;
+        bool slotMatches(const Slot& slot, const std::string& name, uint64_t hash) const;
+        size_t findSlot(const std::string& name, uint64_t hash) const;
+        size_t claim(uint64_t hash);
+        void rehash();
+
+        std::unique_ptr<uint8_t[]> mControl; // One byte per slot, EMPTY or controlOf(hash)
+        std::unique_ptr<Slot[]> mSlots;
+        size_t mCapacity; // Number of slots, a power of two and a multiple of GROUP_SIZE
+        size_t mSize;
+        size_t mDeleted;  // Tombstones, they count towards the load like full slots
+};
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef JOB_POOL_H
+#define JOB_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <new>
+
+// Counters of a JobPool
+struct JobPoolStats
+{
+    uint64_t hits;   // Allocations served from the free list
+    uint64_t misses; // Allocations that went to the heap
+    size_t free;     // Blocks on the free list now
+};
+
+/** Print job pool counters
+ * @param std::ostream& out: stream to print to
+ * @param const JobPoolStats& stats: counters to print
+ * @return std::ostream&: the stream printed to
+ */
+inline std::ostream& operator<<(std::ostream& out, const JobPoolStats& stats)
+{
+    out << "hits=" << stats.hits << " misses=" << stats.misses << " free=" << stats.free;
+    return out;
+}
+
+/** Free list of memory blocks for one job type, used through the job's class
+ * operator new and delete. gRPC has no way to reset a ServerContext or a
+ * responder for another call, so every call still constructs a fresh job,
+ * but in a recycled block instead of one from the heap.
+ */
+template<typename JobType>
+class JobPool
+{
+    public:
+
+        // Blocks kept for reuse, the ones freed beyond this go back to the heap
+        static const size_t MAX_FREE_BLOCKS = 1024;
+
+        /** Accessor for the pool of this job type
+         * @return JobPool&: the pool
+         */
+        static JobPool& instance()
+        {
+            static JobPool pool;
+            return pool;
+        }
+
+        ~JobPool()
+        {
+            while(mFree)
+            {
+                FreeBlock* block = mFree;
+                mFree = block->next;
+                ::operator delete(block);
+            }
+        }
+
+        /** Get a block for a job, from the free list if it has one
+         * @param size_t size: size asked for by operator new
+         * @return void*: block of at least size bytes
+         */
+        void* allocate(size_t size)
+        {
+            if(size == sizeof(JobType))
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if(mFree)
+                {
+                    FreeBlock* block = mFree;
+                    mFree = block->next;
+                    --mFreeCount;
+                    mHits.fetch_add(1, std::memory_order_relaxed);
+                    return block;
+                }
+            }
+
+            mMisses.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+
+        /** Give back the block of a destroyed job
+         * @param void* memory: block returned by allocate
+         * @param size_t size: size of the block
+         */
+        void release(void* memory, size_t size)
+        {
+            if(size == sizeof(JobType))
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if(mFreeCount < MAX_FREE_BLOCKS)
+                {
+                    FreeBlock* block = static_cast<FreeBlock*>(memory);
+                    block->next = mFree;
+                    mFree = block;
+                    ++mFreeCount;
+                    return;
+                }
+            }
+
+            ::operator delete(memory);
+        }
+
+        /** Accessor for the pool counters
+         * @return JobPoolStats: snapshot of the counters
+         */
+        JobPoolStats getStats()
+        {
+            JobPoolStats stats;
+            stats.hits = mHits.load(std::memory_order_relaxed);
+            stats.misses = mMisses.load(std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(mMutex);
+            stats.free = mFreeCount;
+            return stats;
+        }
+
+    private:
+
+        static_assert(sizeof(JobType) >= sizeof(void*), "a free block must hold the link to the next one");
+
+        struct FreeBlock
+        {
+            FreeBlock* next;
+        };
+
+        JobPool(): mFree(nullptr)
+                 , mFreeCount(0)
+                 , mHits(0)
+                 , mMisses(0){}
+
+        std::mutex mMutex;
+        FreeBlock* mFree;
+        size_t mFreeCount;
+        std::atomic<uint64_t> mHits;
+        std::atomic<uint64_t> mMisses;
+};
+
+/** Free lists of memory blocks for coroutine frames. A frame's size depends on
+ * the handler's locals and is only known to the compiler, so blocks are kept
+ * per size class of GRANULE bytes instead of per type. Frames bigger than the
+ * largest class come from the heap.
+ */
+class FramePool
+{
+    public:
+
+        static const size_t GRANULE = 64;
+        static const size_t SIZE_CLASSES = 32;
+        // Blocks kept for reuse in each size class
+        static const size_t MAX_FREE_BLOCKS = 256;
+
+        /** Accessor for the frame pool
+         * @return FramePool&: the pool
+         */
+        static FramePool& instance()
+        {
+            static FramePool pool;
+            return pool;
+        }
+
+        ~FramePool()
+        {
+            for(size_t i = 0; i < SIZE_CLASSES; i++)
+            {
+                while(mFree[i])
+                {
+                    FreeBlock* block = mFree[i];
+                    mFree[i] = block->next;
+                    ::operator delete(block);
+                }
+            }
+        }
+
+        /** Get a block for a coroutine frame, from the free list of its size class if it has one
+         * @param size_t size: size of the frame
+         * @return void*: block of at least size bytes
+         */
+        void* allocate(size_t size)
+        {
+            size_t sizeClass = sizeClassOf(size);
+            if(sizeClass < SIZE_CLASSES)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mMutex);
+                    if(mFree[sizeClass])
+                    {
+                        FreeBlock* block = mFree[sizeClass];
+                        mFree[sizeClass] = block->next;
+                        --mFreeCount[sizeClass];
+                        mHits.fetch_add(1, std::memory_order_relaxed);
+                        return block;
+                    }
+                }
+                // Allocate the whole class so the block fits any frame of it later
+                size = (sizeClass + 1) * GRANULE;
+            }
+
+            mMisses.fetch_add(1, std::memory_order_relaxed);
+            return ::operator new(size);
+        }
+
+        /** Give back the block of a destroyed frame
+         * @param void* memory: block returned by allocate
+         * @param size_t size: size of the frame
+         */
+        void release(void* memory, size_t size)
+        {
+            size_t sizeClass = sizeClassOf(size);
+            if(sizeClass < SIZE_CLASSES)
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if(mFreeCount[sizeClass] < MAX_FREE_BLOCKS)
+                {
+                    FreeBlock* block = static_cast<FreeBlock*>(memory);
+                    block->next = mFree[sizeClass];
+                    mFree[sizeClass] = block;
+                    ++mFreeCount[sizeClass];
+                    return;
+                }
+            }
+
+            ::operator delete(memory);
+        }
+
+        /** Accessor for the pool counters
+         * @return JobPoolStats: snapshot of the counters, free counts the blocks of every class
+         */
+        JobPoolStats getStats()
+        {
+            JobPoolStats stats;
+            stats.hits = mHits.load(std::memory_order_relaxed);
+            stats.misses = mMisses.load(std::memory_order_relaxed);
+            stats.free = 0;
+            std::lock_guard<std::mutex> lock(mMutex);
+            for(size_t i = 0; i < SIZE_CLASSES; i++)
+                stats.free += mFreeCount[i];
+            return stats;
+        }
+
+    private:
+
+        struct FreeBlock
+        {
+            FreeBlock* next;
+        };
+
+        FramePool(): mFree()
+                   , mFreeCount()
+                   , mHits(0)
+                   , mMisses(0){}
+
+        /** Size class of a frame
+         * @param size_t size: size of the frame
+         * @return size_t: index of the class, SIZE_CLASSES or more if too big for any
+         */
+        static size_t sizeClassOf(size_t size)
+        {
+            return (size + GRANULE - 1) / GRANULE - 1;
+        }
+
+        std::mutex mMutex;
+        FreeBlock* mFree[SIZE_CLASSES];
+        size_t mFreeCount[SIZE_CLASSES];
+        std::atomic<uint64_t> mHits;
+        std::atomic<uint64_t> mMisses;
+};
+
+#endif
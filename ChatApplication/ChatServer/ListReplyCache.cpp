@@ -0,0 +1,70 @@
+#include <mutex>
+#include <grpc++/impl/codegen/proto_utils.h>
+#include "ListReplyCache.hpp"
+
+/** ListReplyCache Constructor, the reply is built by the first List
+ * @param ChatCore& core: core holding the online users
+ */
+ListReplyCache::ListReplyCache(ChatCore& core): mCore(core)
+                                              , mVersion(0)
+                                              , mValid(false)
+                                              , mHits(0)
+                                              , mMisses(0){}
+
+/** Get the serialized reply for the users online now
+ * @return grpc::ByteBuffer: the ListReply, sharing its bytes with the cache
+ */
+grpc::ByteBuffer ListReplyCache::get()
+{
+    // Read before the users, a login meanwhile makes the next List rebuild
+    uint64_t version = mCore.presenceVersion();
+    {
+        std::shared_lock<std::shared_mutex> lock(mMutex);
+        if(mValid && mVersion == version)
+        {
+            mHits.fetch_add(1, std::memory_order_relaxed);
+            return mReply;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(mMutex);
+    // Concurrent Lists wait for one rebuild instead of each doing it
+    if(mValid && mVersion == version)
+    {
+        mHits.fetch_add(1, std::memory_order_relaxed);
+        return mReply;
+    }
+
+    chatserver::ListReply reply;
+    reply.set_list(mCore.list());
+    bool ownBuffer;
+    grpc::SerializationTraits<chatserver::ListReply>::Serialize(reply, &mReply, &ownBuffer);
+    mVersion = version;
+    mValid = true;
+    mMisses.fetch_add(1, std::memory_order_relaxed);
+    return mReply;
+}
+
+/** Accessor for the cache counters
+ * @return ListReplyCacheStats: snapshot of the counters
+ */
+ListReplyCacheStats ListReplyCache::getStats() const
+{
+    ListReplyCacheStats stats;
+    stats.hits = mHits.load(std::memory_order_relaxed);
+    stats.misses = mMisses.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/** Print the List cache counters
+ * @param std::ostream& out: stream to print to
+ * @param const ListReplyCacheStats& stats: counters to print
+ * @return std::ostream&: the stream printed to
+ */
+std::ostream& operator<<(std::ostream& out, const ListReplyCacheStats& stats)
+{
+    out << "hits=" << stats.hits << " misses=" << stats.misses;
+    if(stats.hits + stats.misses > 0)
+        out << " hitRate=" << stats.hits * 100 / (stats.hits + stats.misses) << "%";
+    return out;
+}
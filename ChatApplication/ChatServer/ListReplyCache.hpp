@@ -0,0 +1,50 @@
+#ifndef LIST_REPLY_CACHE_H
+#define LIST_REPLY_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <shared_mutex>
+#include <grpc++/grpc++.h>
+#include "ChatCore.hpp"
+
+/** Counters of a ListReplyCache
+ */
+struct ListReplyCacheStats
+{
+    uint64_t hits;   // Replies served from the cached buffer
+    uint64_t misses; // Replies that rebuilt it
+};
+
+std::ostream& operator<<(std::ostream& out, const ListReplyCacheStats& stats);
+
+/** The ListReply for the current online users, serialized once and handed out
+ * as a grpc::ByteBuffer until a login or logout changes the presence version.
+ * Copies of the buffer share its slices, so a hit costs no formatting, no
+ * serialization and no copy of the bytes. The engines send it through the raw
+ * List method.
+ */
+class ListReplyCache
+{
+    public:
+
+        explicit ListReplyCache(ChatCore& core);
+
+        ListReplyCache(const ListReplyCache&) = delete;
+        ListReplyCache& operator=(const ListReplyCache&) = delete;
+
+        grpc::ByteBuffer get();
+        ListReplyCacheStats getStats() const;
+
+    private:
+
+        ChatCore& mCore;
+        mutable std::shared_mutex mMutex; // Shared by hits, exclusive to the rebuild
+        grpc::ByteBuffer mReply;
+        uint64_t mVersion;                // Presence version mReply was built at
+        bool mValid;                      // mReply was built at all
+        std::atomic<uint64_t> mHits;
+        std::atomic<uint64_t> mMisses;
+};
+
+#endif
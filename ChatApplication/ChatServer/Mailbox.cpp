@@ -0,0 +1,177 @@
+#include "Mailbox.hpp"
+
+/** MailboxPolicy Constructor, sets the defaults: SPILL keeps every message like an unbounded queue would
+ */
+MailboxPolicy::MailboxPolicy(): capacity(DEFAULT_CAPACITY)
+                              , overflow(Overflow::SPILL){}
+
+/** Mailbox Constructor, the ring is allocated by the first message
+ * @param const MailboxPolicy& policy: capacity of the ring and overflow behavior
+ */
+Mailbox::Mailbox(const MailboxPolicy& policy): mRing(nullptr)
+                                             , mPolicy(policy)
+                                             , mSpilled(0){}
+
+/** Mailbox Destructor, drops the messages left
+ */
+Mailbox::~Mailbox()
+{
+    // The records go back to the arena before it is destroyed
+    while(Record* record = popLocked())
+        mArena.release(record);
+    delete mRing.load(std::memory_order_relaxed);
+}
+
+/** Get the ring, allocating it if no message came yet
+ * @return Ring*: the ring
+ */
+Mailbox::Ring* Mailbox::ring()
+{
+    Ring* ring = mRing.load(std::memory_order_acquire);
+    if(ring)
+        return ring;
+
+    Ring* fresh = new Ring(mPolicy.capacity);
+    // Another sender may have allocated it meanwhile
+    if(mRing.compare_exchange_strong(ring, fresh, std::memory_order_acq_rel))
+        return fresh;
+
+    delete fresh;
+    return ring;
+}
+
+/** Queue a message, can be called from any thread
+ * @param std::initializer_list<std::string_view> message: pieces of the message, written one after the other
+ * @return Result: QUEUED, or how the overflow policy handled a full ring
+ */
+Mailbox::Result Mailbox::push(std::initializer_list<std::string_view> message)
+{
+    Ring* queue = ring();
+    Record* record = mArena.allocate(message);
+    // Only go around a spill when there is none, or this message would overtake it
+    if(mSpilled.load(std::memory_order_acquire) == 0 && queue->tryPush(record))
+        return Result::QUEUED;
+
+    if(mPolicy.overflow == MailboxPolicy::Overflow::REJECT)
+    {
+        mArena.release(record);
+        return Result::REJECTED;
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(mPolicy.overflow == MailboxPolicy::Overflow::SPILL)
+    {
+        // The receiver may have made room since
+        if(mSpill.empty() && queue->tryPush(record))
+            return Result::QUEUED;
+
+        mSpill.push_back(record);
+        mSpilled.store(mSpill.size(), std::memory_order_release);
+        return Result::SPILLED;
+    }
+
+    // Holding the lock makes this the only consumer, so it can take the oldest message out
+    Record* oldest;
+    while(!queue->tryPush(record))
+    {
+        if(queue->tryPop(oldest))
+            mArena.release(oldest);
+    }
+    return Result::DROPPED_OLDEST;
+}
+
+/** Take the oldest message, mMutex must be held
+ * @return Record*: the message, nullptr if there is none
+ */
+Mailbox::Record* Mailbox::popLocked()
+{
+    Record* record;
+    Ring* queue = mRing.load(std::memory_order_acquire);
+    if(queue && queue->tryPop(record))
+        return record;
+
+    // The spill only fills up behind a full ring, so it is older than anything queued since
+    if(mSpill.empty())
+        return nullptr;
+
+    record = mSpill.front();
+    mSpill.pop_front();
+    mSpilled.store(mSpill.size(), std::memory_order_release);
+    return record;
+}
+
+/** Take the oldest messages at once, with a single lock. The strings of messages
+ * are reused, so draining into the same vector again does not allocate.
+ * @param std::vector<std::string>& messages: replaced by the messages taken, oldest first
+ * @param size_t max: most messages to take
+ * @return size_t: number of messages taken, 0 if the mailbox is empty
+ */
+size_t Mailbox::drain(std::vector<std::string>& messages, size_t max)
+{
+    if(messages.size() < max)
+        messages.resize(max);
+
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        while(count < max)
+        {
+            Record* record = popLocked();
+            if(!record)
+                break;
+
+            std::string_view text = record->text();
+            messages[count++].assign(text.data(), text.size());
+            mArena.release(record);
+        }
+    }
+
+    // Emptied, give the memory back until the next message
+    if(count < max)
+        mArena.trim();
+
+    messages.resize(count);
+    return count;
+}
+
+/** Count the messages, approximate while senders are active
+ * @return size_t: messages waiting
+ */
+size_t Mailbox::size() const
+{
+    Ring* queue = mRing.load(std::memory_order_acquire);
+    return (queue ? queue->depth() : 0) + mSpilled.load(std::memory_order_relaxed);
+}
+
+/** Accessor for the text of the waiting messages
+ * @return size_t: bytes of text
+ */
+size_t Mailbox::payloadBytes() const
+{
+    return mArena.payloadBytes();
+}
+
+/** Accessor for the memory of the arena
+ * @return size_t: bytes of its blocks
+ */
+size_t Mailbox::arenaBytes() const
+{
+    return mArena.blockBytes();
+}
+
+/** Print the mailbox counters
+ * @param std::ostream& out: stream to print to
+ * @param const MailboxStats& stats: counters to print
+ * @return std::ostream&: the stream printed to
+ */
+std::ostream& operator<<(std::ostream& out, const MailboxStats& stats)
+{
+    out << "spilled=" << stats.spilled << " droppedOldest=" << stats.droppedOldest << " rejected=" << stats.rejected
+        << " messages=" << stats.messages << " payloadBytes=" << stats.payloadBytes << " arenaBytes=" << stats.arenaBytes
+        << " subscribers=" << stats.subscribers;
+    if(stats.messages > 0)
+        out << " bytesPerMessage=" << stats.arenaBytes / stats.messages;
+    if(stats.arenaBytes > 0)
+        out << " fragmentation=" << 100 - stats.payloadBytes * 100 / stats.arenaBytes << "%";
+    return out;
+}
@@ -0,0 +1,128 @@
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "MessageArena.hpp"
+#include "MpscQueue.hpp"
+
+/** How the mailboxes are sized and what happens to a message sent to a full one
+ */
+struct MailboxPolicy
+{
+    // REJECT refuses the message, SPILL queues it past the ring, DROP_OLDEST makes room by discarding the oldest one
+    enum class Overflow {REJECT, SPILL, DROP_OLDEST};
+
+    static const size_t DEFAULT_CAPACITY = 64;
+
+    MailboxPolicy();
+
+    size_t capacity;   // Messages the ring holds, rounded up to a power of two
+    Overflow overflow;
+};
+
+/** A ReceiveMessage stream subscribed to a mailbox, as the core sees it. The
+ * engines wrap their rpc in it, the mailbox's owner notifies it after every
+ * message queued and the engine drains the mailbox when its stream can take
+ * more. A subscriber replaced by a newer one is closed and notified once more,
+ * it should then finish its rpc. notify() is called from the senders' threads
+ * and must not block, it may come after the rpc is gone.
+ */
+class MailboxSubscriber
+{
+    public:
+
+        MailboxSubscriber(): mClosed(false){}
+        virtual ~MailboxSubscriber() = default;
+
+        MailboxSubscriber(const MailboxSubscriber&) = delete;
+        MailboxSubscriber& operator=(const MailboxSubscriber&) = delete;
+
+        virtual void notify() = 0;
+
+        void close()
+        {
+            mClosed.store(true, std::memory_order_release);
+        }
+
+        bool closed() const
+        {
+            return mClosed.load(std::memory_order_acquire);
+        }
+
+    private:
+
+        std::atomic<bool> mClosed;
+};
+
+/** Messages waiting for a user. The text of a message is written once into
+ * the mailbox's MessageArena, and senders push the record into a bounded
+ * lock-free ring that is only allocated once the first message arrives. The
+ * receiving side is serialized by a mutex senders only take once the ring is
+ * full. With SPILL the records that do not fit go to a deque, and the senders
+ * keep queueing there until the receiver empties it so every sender's
+ * messages stay in order.
+ */
+class Mailbox
+{
+    public:
+
+        // What push() did with the message
+        enum class Result {QUEUED, SPILLED, DROPPED_OLDEST, REJECTED};
+
+        // Messages the rpcs reading a mailbox take out with each drain()
+        static const size_t DRAIN_BATCH = 32;
+
+        explicit Mailbox(const MailboxPolicy& policy);
+        ~Mailbox();
+
+        Mailbox(const Mailbox&) = delete;
+        Mailbox& operator=(const Mailbox&) = delete;
+
+        Result push(std::initializer_list<std::string_view> message);
+        size_t drain(std::vector<std::string>& messages, size_t max);
+        size_t size() const;
+        size_t payloadBytes() const;
+        size_t arenaBytes() const;
+
+    private:
+
+        typedef MessageArena::Record Record;
+        typedef MpscQueue<Record*> Ring;
+
+        Ring* ring();
+        Record* popLocked();
+
+        MessageArena mArena;            // Outlives the records of the ring and the spill
+        std::atomic<Ring*> mRing;       // nullptr until the first message
+        MailboxPolicy mPolicy;
+        std::mutex mMutex;              // Taken by receivers, and by senders once the ring is full
+        std::deque<Record*> mSpill;     // Guarded by mMutex
+        std::atomic<size_t> mSpilled;   // Size of mSpill, read by senders without the lock
+};
+
+/** Messages that did not fit in their ring, counted since the server started,
+ * and the memory of the messages waiting now
+ */
+struct MailboxStats
+{
+    uint64_t spilled;
+    uint64_t droppedOldest;
+    uint64_t rejected;
+    size_t messages;      // Messages waiting
+    size_t payloadBytes;  // Text of the waiting messages
+    size_t arenaBytes;    // Blocks of the arenas holding them, headers and unused space included
+    size_t subscribers;   // Mailboxes pushed to a ReceiveMessage stream as messages come in
+};
+
+std::ostream& operator<<(std::ostream& out, const MailboxStats& stats);
+
+#endif
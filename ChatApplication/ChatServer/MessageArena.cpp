@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include "MessageArena.hpp"
+
+// Records start on a pointer boundary
+static const size_t RECORD_ALIGNMENT = alignof(MessageArena::Record);
+
+/** Round a size up to the record alignment
+ * @param size_t size: size to round
+ * @return size_t: the rounded size
+ */
+static size_t alignRecord(size_t size)
+{
+    return (size + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+}
+
+/** MessageArena Constructor, the first block is allocated by the first record
+ */
+MessageArena::MessageArena(): mOpen(nullptr)
+                            , mBlockBytes(0)
+                            , mPayloadBytes(0){}
+
+/** MessageArena Destructor, every record must be released already
+ */
+MessageArena::~MessageArena()
+{
+    if(mOpen)
+        releaseBlock(mOpen);
+}
+
+/** Copy a message into the arena
+ * @param std::initializer_list<std::string_view> parts: pieces of the text, concatenated in the record
+ * @return Record*: the record, to be released once the message is read
+ */
+MessageArena::Record* MessageArena::allocate(std::initializer_list<std::string_view> parts)
+{
+    size_t length = 0;
+    for(std::string_view part : parts)
+        length += part.size();
+    size_t recordSize = alignRecord(sizeof(Record) + length);
+
+    Block* block;
+    size_t offset;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(!mOpen || mOpen->used + recordSize > mOpen->size)
+        {
+            // Double the block size with every block, a message too long for any block gets one of its own
+            size_t size = mOpen ? std::min<size_t>(mOpen->size * 2, MAX_BLOCK_SIZE) : MIN_BLOCK_SIZE;
+            size = std::max(size, recordSize);
+
+            Block* fresh = static_cast<Block*>(::operator new(sizeof(Block) + size));
+            fresh->references.store(1, std::memory_order_relaxed);
+            fresh->size = (uint32_t)size;
+            fresh->used = 0;
+            mBlockBytes.fetch_add(sizeof(Block) + size, std::memory_order_relaxed);
+
+            // The old block is freed by whoever releases its last record
+            if(mOpen)
+                releaseBlock(mOpen);
+            mOpen = fresh;
+        }
+
+        block = mOpen;
+        offset = block->used;
+        block->used += recordSize;
+        block->references.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The bytes are reserved, the text is copied without the lock
+    Record* record = reinterpret_cast<Record*>(reinterpret_cast<char*>(block + 1) + offset);
+    record->block = block;
+    record->length = (uint32_t)length;
+    char* text = reinterpret_cast<char*>(record + 1);
+    for(std::string_view part : parts)
+    {
+        std::memcpy(text, part.data(), part.size());
+        text += part.size();
+    }
+
+    mPayloadBytes.fetch_add(length, std::memory_order_relaxed);
+    return record;
+}
+
+/** Give a record back, its block is freed along with its last record
+ * @param Record* record: record returned by allocate()
+ */
+void MessageArena::release(Record* record)
+{
+    mPayloadBytes.fetch_sub(record->length, std::memory_order_relaxed);
+    releaseBlock(record->block);
+}
+
+/** Free the open block if none of its records is left, so an arena that was
+ * read out takes no memory. The next record starts a new block.
+ */
+void MessageArena::trim()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    // Only the open reference is left, and new records need the lock
+    if(mOpen && mOpen->references.load(std::memory_order_acquire) == 1)
+    {
+        releaseBlock(mOpen);
+        mOpen = nullptr;
+    }
+}
+
+/** Drop a reference on a block, freeing it if it was the last
+ * @param Block* block: block to release
+ */
+void MessageArena::releaseBlock(Block* block)
+{
+    if(block->references.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    mBlockBytes.fetch_sub(sizeof(Block) + block->size, std::memory_order_relaxed);
+    ::operator delete(block);
+}
+
+/** Accessor for the memory taken by the blocks
+ * @return size_t: bytes of the blocks, headers included
+ */
+size_t MessageArena::blockBytes() const
+{
+    return mBlockBytes.load(std::memory_order_relaxed);
+}
+
+/** Accessor for the text held by the records
+ * @return size_t: bytes of text not released yet
+ */
+size_t MessageArena::payloadBytes() const
+{
+    return mPayloadBytes.load(std::memory_order_relaxed);
+}
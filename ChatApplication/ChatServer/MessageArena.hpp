@@ -0,0 +1,75 @@
+#ifndef MESSAGE_ARENA_H
+#define MESSAGE_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <mutex>
+#include <string_view>
+
+/** Storage for the messages of one mailbox. A message is a record, a small
+ * header followed by its text, appended to the open block of the arena. Blocks
+ * start at MIN_BLOCK_SIZE bytes and double up to MAX_BLOCK_SIZE, so a mailbox
+ * that gets little mail stays small. A block counts the records still in it
+ * and is freed as a whole once they are all released and it is no longer open.
+ * Records can be allocated and released from any thread.
+ */
+class MessageArena
+{
+    private:
+
+        struct Block;
+
+    public:
+
+        static constexpr size_t MIN_BLOCK_SIZE = 256;
+        static constexpr size_t MAX_BLOCK_SIZE = 4096;
+
+        /** A message in the arena, the text follows the header
+         */
+        struct Record
+        {
+            Block* block;
+            uint32_t length;
+
+            /** Accessor for the text of the message
+             * @return std::string_view: the text, valid until the record is released
+             */
+            std::string_view text() const
+            {
+                return std::string_view(reinterpret_cast<const char*>(this + 1), length);
+            }
+        };
+
+        MessageArena();
+        ~MessageArena();
+
+        MessageArena(const MessageArena&) = delete;
+        MessageArena& operator=(const MessageArena&) = delete;
+
+        Record* allocate(std::initializer_list<std::string_view> parts);
+        void release(Record* record);
+        void trim();
+
+        size_t blockBytes() const;
+        size_t payloadBytes() const;
+
+    private:
+
+        struct alignas(alignof(Record)) Block
+        {
+            std::atomic<uint32_t> references; // Records in the block, plus one while it is open
+            uint32_t size;                    // Bytes of records the block holds
+            uint32_t used;                    // Bytes handed out, guarded by mMutex
+        };
+
+        void releaseBlock(Block* block);
+
+        std::mutex mMutex;                  // Guards mOpen and its used bytes, only held to reserve a record
+        Block* mOpen;                       // Block records are appended to, nullptr until the first one
+        std::atomic<size_t> mBlockBytes;    // Bytes of all the blocks not freed yet
+        std::atomic<size_t> mPayloadBytes;  // Text of the records not released yet
+};
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#define CACHE_LINE_SIZE 64
+
+/** Bounded lock-free multi-producer single-consumer ring queue.
+ * Every cell carries a sequence number telling whether it is free for the
+ * producers of the current lap or holds a value for the consumer (Vyukov's
+ * bounded queue, with the consumer side simplified for a single thread).
+ * The producer and consumer positions live on separate cache lines.
+ */
+template<typename T>
+class MpscQueue
+{
+    public:
+
+        /** MpscQueue Constructor
+         * @param size_t capacity: number of cells, rounded up to a power of two
+         */
+        explicit MpscQueue(size_t capacity): mCells(roundUpToPowerOfTwo(capacity))
+                                           , mMask(mCells.size() - 1)
+                                           , mEnqueuePos(0)
+                                           , mHighWater(0)
+                                           , mDequeuePos(0)
+        {
+            for(size_t i = 0; i < mCells.size(); i++)
+                mCells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        /** Add a value, can be called from any thread
+         * @param U&& value: value to add, only moved from if it was added
+         * @return bool: true if added, false if the queue is full
+         */
+        template<typename U>
+        bool tryPush(U&& value)
+        {
+            size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+            Cell* cell;
+            while(true)
+            {
+                cell = &mCells[pos & mMask];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+                if(diff == 0)
+                {
+                    if(mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if(diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = mEnqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->value = std::forward<U>(value);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            updateHighWater(pos + 1);
+            return true;
+        }
+
+        /** Add several values at once, claiming all their cells with a single
+         * compare-and-swap. Either all of them are added or none.
+         * @param T* values: values to add, moved from on success
+         * @param size_t count: number of values, at most the capacity
+         * @return bool: true if added, false if there is not enough room
+         */
+        bool tryPushBatch(T* values, size_t count)
+        {
+            if(count == 0)
+                return true;
+
+            size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+            while(true)
+            {
+                // The consumer frees cells in order, so if the last cell we
+                // need is free for this lap all cells before it are as well
+                size_t last = pos + count - 1;
+                size_t sequence = mCells[last & mMask].sequence.load(std::memory_order_acquire);
+                intptr_t diff = (intptr_t)sequence - (intptr_t)last;
+                if(diff == 0)
+                {
+                    if(mEnqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+                        break;
+                }
+                else if(diff < 0)
+                {
+                    return false;
+                }
+                else
+                {
+                    pos = mEnqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+
+            for(size_t i = 0; i < count; i++)
+            {
+                Cell& cell = mCells[(pos + i) & mMask];
+                cell.value = std::move(values[i]);
+                cell.sequence.store(pos + i + 1, std::memory_order_release);
+            }
+            updateHighWater(pos + count);
+            return true;
+        }
+
+        /** Take the oldest value, must only be called from the consumer thread
+         * @param T& value: where to store the value
+         * @return bool: true if a value was taken, false if the queue is empty
+         */
+        bool tryPop(T& value)
+        {
+            size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+            Cell& cell = mCells[pos & mMask];
+            if(cell.sequence.load(std::memory_order_acquire) != pos + 1)
+                return false;
+
+            value = std::move(cell.value);
+            cell.sequence.store(pos + mMask + 1, std::memory_order_release);
+            mDequeuePos.store(pos + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /** Take up to max values, must only be called from the consumer thread
+         * @param T* values: where to store the values
+         * @param size_t max: room in values
+         * @return size_t: number of values taken
+         */
+        size_t tryPopBatch(T* values, size_t max)
+        {
+            size_t count = 0;
+            while(count < max && tryPop(values[count]))
+                ++count;
+            return count;
+        }
+
+        /** Check for a value ready to be taken, must only be called from the consumer thread
+         * @return bool: true if tryPop would fail
+         */
+        bool empty() const
+        {
+            size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+            return mCells[pos & mMask].sequence.load(std::memory_order_acquire) != pos + 1;
+        }
+
+        /** Accessor method for the number of queued values, approximate while producers are active
+         * @return size_t: values claimed by producers and not yet taken
+         */
+        size_t depth() const
+        {
+            size_t enqueued = mEnqueuePos.load(std::memory_order_relaxed);
+            size_t dequeued = mDequeuePos.load(std::memory_order_relaxed);
+            return enqueued > dequeued ? enqueued - dequeued : 0;
+        }
+
+        /** Accessor method for the largest depth seen by a producer
+         * @return size_t: high-water mark
+         */
+        size_t highWater() const
+        {
+            return mHighWater.load(std::memory_order_relaxed);
+        }
+
+        /** Accessor method for the number of cells
+         * @return size_t: capacity
+         */
+        size_t capacity() const
+        {
+            return mMask + 1;
+        }
+
+    private:
+
+        struct Cell
+        {
+            Cell(): sequence(0), value() {}
+
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        /** Round a capacity up to the next power of two so positions can be masked
+         * @param size_t capacity: requested capacity
+         * @return size_t: number of cells to allocate
+         */
+        static size_t roundUpToPowerOfTwo(size_t capacity)
+        {
+            size_t size = 2;
+            while(size < capacity)
+                size <<= 1;
+            return size;
+        }
+
+        /** Record the depth after a push if it is a new maximum
+         * @param size_t enqueued: enqueue position after the push
+         */
+        void updateHighWater(size_t enqueued)
+        {
+            size_t dequeued = mDequeuePos.load(std::memory_order_relaxed);
+            size_t depth = enqueued > dequeued ? enqueued - dequeued : 0;
+            size_t high = mHighWater.load(std::memory_order_relaxed);
+            while(depth > high
+               && !mHighWater.compare_exchange_weak(high, depth, std::memory_order_relaxed))
+                ;
+        }
+
+        std::vector<Cell> mCells;
+        size_t mMask;
+
+        // Producers
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> mEnqueuePos;
+        std::atomic<size_t> mHighWater;
+
+        // Consumer, only written by the consumer thread but read for the stats
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> mDequeuePos;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <unordered_map>
+#include "EpochReclaimer.hpp"
+#include "PresenceFeed.hpp"
+
+/** Fill a user entry of an update
+ * @param chatserver::UserEntry* entry: entry to fill
+ * @param const UserNode* node: the user
+ */
+static void setEntry(chatserver::UserEntry* entry, const UserNode* node)
+{
+    entry->set_user(node->getName());
+    entry->set_userid(node->getId());
+}
+
+/** PresenceFeed Constructor, starts the feed's thread
+ * @param PresenceIndex& presence: index journaling the logins and logouts
+ * @param int windowMs: milliseconds the changes are gathered over before a delta is sent
+ */
+PresenceFeed::PresenceFeed(PresenceIndex& presence, int windowMs): mPresence(presence)
+                                                                 , mWindow(windowMs)
+                                                                 , mStopping(false)
+                                                                 , mSnapshots(0)
+                                                                 , mUpdates(0)
+                                                                 , mJoins(0)
+                                                                 , mLeaves(0)
+                                                                 , mFlaps(0)
+                                                                 , mThread(&PresenceFeed::run, this){}
+
+/** PresenceFeed Destructor, stops the feed's thread. The streams still
+ * subscribed get nothing more.
+ */
+PresenceFeed::~PresenceFeed()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_one();
+    mThread.join();
+}
+
+/** Add a stream to the feed, its snapshot is sent right away
+ * @param std::shared_ptr<PresenceWatcher> watcher: the stream
+ */
+void PresenceFeed::subscribe(std::shared_ptr<PresenceWatcher> watcher)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJoining.push_back(std::move(watcher));
+    }
+    mCondition.notify_one();
+}
+
+/** Accessor for the feed counters
+ * @return PresenceFeedStats: snapshot of the counters
+ */
+PresenceFeedStats PresenceFeed::getStats() const
+{
+    PresenceFeedStats stats;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        stats.watchers = mWatchers.size() + mJoining.size();
+    }
+    stats.snapshots = mSnapshots.load(std::memory_order_relaxed);
+    stats.updates = mUpdates.load(std::memory_order_relaxed);
+    stats.joins = mJoins.load(std::memory_order_relaxed);
+    stats.leaves = mLeaves.load(std::memory_order_relaxed);
+    stats.flaps = mFlaps.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/** Body of the feed's thread, publishes once per window, and as soon as a
+ * stream waits for its snapshot
+ */
+void PresenceFeed::run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        mCondition.wait_for(lock, mWindow, [this]{ return mStopping || !mJoining.empty(); });
+        if(mStopping)
+            return;
+
+        lock.unlock();
+        publish();
+        lock.lock();
+    }
+}
+
+/** Send the changes of the window to the streams that have their snapshot,
+ * then the snapshot to the new ones
+ */
+void PresenceFeed::publish()
+{
+    std::vector<std::shared_ptr<PresenceWatcher>> watchers;
+    std::vector<std::shared_ptr<PresenceWatcher>> joining;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        // The streams done since the last pass are dropped
+        mWatchers.erase(std::remove_if(mWatchers.begin(), mWatchers.end(),
+                                       [](const std::shared_ptr<PresenceWatcher>& watcher){ return watcher->closed(); }),
+                        mWatchers.end());
+        watchers = mWatchers;
+        joining.swap(mJoining);
+    }
+
+    // The users taken stay valid until the pass ends, even if they are evicted meanwhile
+    EpochGuard guard;
+
+    // Taken together, the snapshot holds exactly the changes up to the version
+    std::vector<PresenceIndex::Change> changes;
+    std::vector<const UserNode*> online;
+    uint64_t version = mPresence.takeChanges(changes, joining.empty() ? nullptr : &online);
+
+    if(!changes.empty())
+    {
+        // Whether each user was online before the window and is now, in the order they first changed
+        std::unordered_map<const UserNode*, std::pair<bool, bool>> states;
+        std::vector<const UserNode*> order;
+        for(const PresenceIndex::Change& change : changes)
+        {
+            auto inserted = states.emplace(change.node, std::make_pair(!change.online, change.online));
+            if(inserted.second)
+                order.push_back(change.node);
+            else
+                inserted.first->second.second = change.online;
+        }
+
+        chatserver::PresenceUpdate update;
+        update.set_sequence(version);
+        for(const UserNode* node : order)
+        {
+            const std::pair<bool, bool>& state = states[node];
+            if(state.first == state.second)
+                mFlaps.fetch_add(1, std::memory_order_relaxed);
+            else if(state.second)
+                setEntry(update.add_joined(), node);
+            else
+                setEntry(update.add_left(), node);
+        }
+
+        // Users who all flapped leave nothing to send, the next delta jumps over the version
+        if(update.joined_size() + update.left_size() > 0)
+        {
+            mUpdates.fetch_add(1, std::memory_order_relaxed);
+            mJoins.fetch_add(update.joined_size(), std::memory_order_relaxed);
+            mLeaves.fetch_add(update.left_size(), std::memory_order_relaxed);
+            for(const std::shared_ptr<PresenceWatcher>& watcher : watchers)
+            {
+                if(!watcher->closed())
+                    watcher->send(update);
+            }
+        }
+    }
+
+    if(!joining.empty())
+    {
+        chatserver::PresenceUpdate snapshot;
+        snapshot.set_sequence(version);
+        snapshot.set_snapshot(true);
+        for(const UserNode* node : online)
+            setEntry(snapshot.add_joined(), node);
+
+        for(const std::shared_ptr<PresenceWatcher>& watcher : joining)
+        {
+            watcher->send(snapshot);
+            mSnapshots.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mWatchers.insert(mWatchers.end(), joining.begin(), joining.end());
+    }
+}
+
+/** Print the feed counters
+ * @param std::ostream& out: stream to print to
+ * @param const PresenceFeedStats& stats: counters to print
+ * @return std::ostream&: the stream printed to
+ */
+std::ostream& operator<<(std::ostream& out, const PresenceFeedStats& stats)
+{
+    out << "watchers=" << stats.watchers
+        << " snapshots=" << stats.snapshots
+        << " updates=" << stats.updates
+        << " joins=" << stats.joins
+        << " leaves=" << stats.leaves
+        << " flaps=" << stats.flaps;
+    return out;
+}
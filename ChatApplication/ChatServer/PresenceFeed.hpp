@@ -0,0 +1,110 @@
+#ifndef PRESENCE_FEED_H
+#define PRESENCE_FEED_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "chatserver.pb.h"
+#include "PresenceIndex.hpp"
+
+/** A WatchPresence stream as the feed sees it. The engines wrap their rpc in it
+ * and close it when the rpc is done, the feed then drops it. An update already
+ * on its way may still be sent after close(), so send() has to cope with an rpc
+ * that is gone.
+ */
+class PresenceWatcher
+{
+    public:
+
+        PresenceWatcher(): mClosed(false){}
+        virtual ~PresenceWatcher() = default;
+
+        PresenceWatcher(const PresenceWatcher&) = delete;
+        PresenceWatcher& operator=(const PresenceWatcher&) = delete;
+
+        // Called from the feed's thread only, one update at a time and in order
+        virtual void send(const chatserver::PresenceUpdate& update) = 0;
+
+        void close()
+        {
+            mClosed.store(true, std::memory_order_release);
+        }
+
+        bool closed() const
+        {
+            return mClosed.load(std::memory_order_acquire);
+        }
+
+    private:
+
+        std::atomic<bool> mClosed;
+};
+
+/** Counters of a PresenceFeed
+ */
+struct PresenceFeedStats
+{
+    size_t watchers;    // Streams subscribed, closed ones count until the next window drops them
+    uint64_t snapshots; // Snapshots sent, one per stream
+    uint64_t updates;   // Deltas sent, counted once whatever the number of streams
+    uint64_t joins;     // Users sent as joined
+    uint64_t leaves;    // Users sent as left
+    uint64_t flaps;     // Users back in the state they started the window in, not sent
+};
+
+std::ostream& operator<<(std::ostream& out, const PresenceFeedStats& stats);
+
+/** Pushes the presence changes to the WatchPresence streams. The logins and
+ * logouts journaled by the presence index are taken once per window, reduced to
+ * one change per user and sent as one delta to every stream. A new stream gets
+ * its snapshot at the next pass, which runs right away, taken along with the
+ * journal so that the deltas after it start exactly where it ends.
+ * Everything is sent from the feed's own thread with no lock held, so the
+ * updates of a stream go out in order whatever the engine does in send().
+ */
+class PresenceFeed
+{
+    public:
+
+        static const int DEFAULT_WINDOW_MS = 50;
+
+        PresenceFeed(PresenceIndex& presence, int windowMs = DEFAULT_WINDOW_MS);
+        ~PresenceFeed();
+
+        PresenceFeed(const PresenceFeed&) = delete;
+        PresenceFeed& operator=(const PresenceFeed&) = delete;
+
+        void subscribe(std::shared_ptr<PresenceWatcher> watcher);
+        PresenceFeedStats getStats() const;
+
+    private:
+
+        void run();
+        void publish();
+
+        PresenceIndex& mPresence;
+        const std::chrono::milliseconds mWindow; // Time the changes are gathered over before a delta is sent
+
+        mutable std::mutex mMutex; // Guards the members up to mStopping
+        std::condition_variable mCondition;
+        std::vector<std::shared_ptr<PresenceWatcher>> mWatchers; // Got their snapshot, get the deltas
+        std::vector<std::shared_ptr<PresenceWatcher>> mJoining;  // Waiting for their snapshot
+        bool mStopping;
+
+        std::atomic<uint64_t> mSnapshots;
+        std::atomic<uint64_t> mUpdates;
+        std::atomic<uint64_t> mJoins;
+        std::atomic<uint64_t> mLeaves;
+        std::atomic<uint64_t> mFlaps;
+
+        std::thread mThread; // Started last, once the members above are set up
+};
+
+#endif
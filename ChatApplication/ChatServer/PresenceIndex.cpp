@@ -0,0 +1,105 @@
+#include <mutex>
+#include "PresenceIndex.hpp"
+
+/** PresenceIndex Constructor, no one is online
+ */
+PresenceIndex::PresenceIndex(): mVersion(0)
+                               , mTakenVersion(0){}
+
+/** Set a user online
+ * @param UserNode* node: the user
+ * @return bool: false if it was online already, or is being evicted
+ */
+bool PresenceIndex::add(UserNode* node)
+{
+    std::unique_lock<std::shared_mutex> lock(mMutex);
+    if(node->online_.load(std::memory_order_relaxed) || node->mEvicted.load(std::memory_order_relaxed))
+        return false;
+
+    node->mOnlineSlot = mOnline.size();
+    mOnline.push_back(node);
+    mByName.emplace(node->getName(), node);
+    node->online_.store(true, std::memory_order_release);
+    mChanges.push_back(Change{node, true});
+    node->mPresenceVersion = mVersion.fetch_add(1, std::memory_order_release) + 1;
+    return true;
+}
+
+/** Set a user offline
+ * @param UserNode* node: the user
+ * @return bool: false if it was offline already
+ */
+bool PresenceIndex::remove(UserNode* node)
+{
+    std::unique_lock<std::shared_mutex> lock(mMutex);
+    if(!node->online_.load(std::memory_order_relaxed))
+        return false;
+
+    // Fill the hole with the last user
+    UserNode* last = mOnline.back();
+    mOnline[node->mOnlineSlot] = last;
+    last->mOnlineSlot = node->mOnlineSlot;
+    mOnline.pop_back();
+    mByName.erase(node->getName());
+    node->online_.store(false, std::memory_order_release);
+    mChanges.push_back(Change{node, false});
+    node->mPresenceVersion = mVersion.fetch_add(1, std::memory_order_release) + 1;
+    return true;
+}
+
+/** Mark an offline user evicted, it can't log in until restore()
+ * @param UserNode* node: the user
+ * @return bool: false if it is online, or has a change the feed has not taken yet
+ */
+bool PresenceIndex::evict(UserNode* node)
+{
+    std::unique_lock<std::shared_mutex> lock(mMutex);
+    if(node->online_.load(std::memory_order_relaxed) || node->mPresenceVersion > mTakenVersion)
+        return false;
+
+    node->mEvicted.store(true, std::memory_order_seq_cst);
+    return true;
+}
+
+/** Let a user marked evicted log in again, when it is kept after all
+ * @param UserNode* node: the user
+ */
+void PresenceIndex::restore(UserNode* node)
+{
+    std::unique_lock<std::shared_mutex> lock(mMutex);
+    node->mEvicted.store(false, std::memory_order_release);
+}
+
+/** Count the online users
+ * @return size_t: number of users online
+ */
+size_t PresenceIndex::size() const
+{
+    std::shared_lock<std::shared_mutex> lock(mMutex);
+    return mOnline.size();
+}
+
+/** Accessor for the version, read it before reading the index to tag what is built from it
+ * @return uint64_t: number of logins and logouts so far
+ */
+uint64_t PresenceIndex::version() const
+{
+    return mVersion.load(std::memory_order_acquire);
+}
+
+/** Take the changes journaled since the last call, and optionally the users
+ * online after them, both at once
+ * @param std::vector<Change>& changes: where to store the changes, in order
+ * @param std::vector<const UserNode*>* online: where to store the online users, nullptr if not needed
+ * @return uint64_t: the version the changes bring the index to
+ */
+uint64_t PresenceIndex::takeChanges(std::vector<Change>& changes, std::vector<const UserNode*>* online)
+{
+    changes.clear();
+    std::unique_lock<std::shared_mutex> lock(mMutex);
+    changes.swap(mChanges);
+    if(online)
+        online->assign(mOnline.begin(), mOnline.end());
+    mTakenVersion = mVersion.load(std::memory_order_relaxed);
+    return mTakenVersion;
+}
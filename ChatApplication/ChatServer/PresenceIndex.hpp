@@ -0,0 +1,97 @@
+#ifndef PRESENCE_INDEX_H
+#define PRESENCE_INDEX_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+#include "UserNode.hpp"
+
+/** The users online now, kept apart from the directory so that listing them
+ * costs the number of online users rather than every user that ever logged
+ * in. A user is set online or offline only through the index, which flips the
+ * node's flag and its place in the index under one lock, so the two always
+ * agree. Each node remembers its position, removing it swaps the last node in.
+ * Every change bumps a version, so readers can tell whether what they built
+ * from the index is still current. The online users are also kept sorted by
+ * name, for pages and prefix searches, and every change is journaled until the
+ * presence feed takes it. Evicting a user goes through the index too, so that
+ * it can't log in meanwhile, nor be evicted while the feed still has to read it.
+ */
+class PresenceIndex
+{
+    public:
+
+        // A login or logout, in the order they happened
+        struct Change
+        {
+            const UserNode* node;
+            bool online;
+        };
+
+        PresenceIndex();
+
+        PresenceIndex(const PresenceIndex&) = delete;
+        PresenceIndex& operator=(const PresenceIndex&) = delete;
+
+        bool add(UserNode* node);
+        bool remove(UserNode* node);
+        bool evict(UserNode* node);
+        void restore(UserNode* node);
+        template<typename Function>
+        void forEach(Function&& function) const;
+        template<typename Function>
+        bool forEachByName(std::string_view prefix, std::string_view after, size_t limit, Function&& function) const;
+        size_t size() const;
+        uint64_t version() const;
+        uint64_t takeChanges(std::vector<Change>& changes, std::vector<const UserNode*>* online);
+
+    private:
+
+        mutable std::shared_mutex mMutex; // Shared by readers, exclusive to logins and logouts
+        std::vector<UserNode*> mOnline;
+        std::map<std::string_view, UserNode*> mByName; // Same users, keyed by a view of the node's name
+        std::vector<Change> mChanges;                  // Changes not taken yet
+        std::atomic<uint64_t> mVersion;   // Changes of the index so far, written under mMutex
+        uint64_t mTakenVersion;           // Version of the last change taken by the feed
+};
+
+/** Call a function on every online user, with the index locked for reading.
+ * Logins and logouts wait for it, so the function should be short.
+ * @param Function&& function: callable taking a const UserNode&
+ */
+template<typename Function>
+void PresenceIndex::forEach(Function&& function) const
+{
+    std::shared_lock<std::shared_mutex> lock(mMutex);
+    for(const UserNode* node : mOnline)
+        function(*node);
+}
+
+/** Call a function on the online users whose name starts with a prefix, in
+ * name order, with the index locked for reading
+ * @param std::string_view prefix: prefix of the names, empty for every user
+ * @param std::string_view after: name to start after, empty to start with the first one
+ * @param size_t limit: most users to call the function on
+ * @param Function&& function: callable taking a const UserNode&
+ * @return bool: true if more users match after the last one visited
+ */
+template<typename Function>
+bool PresenceIndex::forEachByName(std::string_view prefix, std::string_view after, size_t limit, Function&& function) const
+{
+    std::shared_lock<std::shared_mutex> lock(mMutex);
+    // The matching names are one run of the map, starting at the prefix itself
+    auto it = (after.empty() || after < prefix) ? mByName.lower_bound(prefix) : mByName.upper_bound(after);
+    for(; it != mByName.end() && it->first.substr(0, prefix.size()) == prefix; ++it)
+    {
+        if(limit-- == 0)
+            return true;
+        function(*it->second);
+    }
+    return false;
+}
+
+#endif
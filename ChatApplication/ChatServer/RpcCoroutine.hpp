@@ -0,0 +1,219 @@
+#ifndef RPC_COROUTINE_H
+#define RPC_COROUTINE_H
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include "JobPool.hpp"
+
+/** Coroutine running the handler of a streaming rpc. It starts suspended, the
+ * RpcStream it belongs to resumes it, and destroying it destroys the frame
+ * wherever the handler is suspended. The frames come from the FramePool.
+ */
+class RpcHandler
+{
+    public:
+
+        struct promise_type
+        {
+            static void* operator new(size_t size)
+            {
+                return FramePool::instance().allocate(size);
+            }
+
+            static void operator delete(void* memory, size_t size)
+            {
+                FramePool::instance().release(memory, size);
+            }
+
+            RpcHandler get_return_object()
+            {
+                return RpcHandler(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            // Stay suspended at the end so the owner can tell the handler returned
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        RpcHandler(): mHandle(nullptr){}
+
+        RpcHandler(RpcHandler&& other) noexcept: mHandle(std::exchange(other.mHandle, nullptr)){}
+
+        RpcHandler& operator=(RpcHandler&& other) noexcept
+        {
+            std::swap(mHandle, other.mHandle);
+            return *this;
+        }
+
+        RpcHandler(const RpcHandler&) = delete;
+        RpcHandler& operator=(const RpcHandler&) = delete;
+
+        ~RpcHandler()
+        {
+            if (mHandle)
+                mHandle.destroy();
+        }
+
+        /** Check whether the handler was started
+         * @return bool: true once the coroutine exists
+         */
+        explicit operator bool() const
+        {
+            return mHandle != nullptr;
+        }
+
+        /** Run the handler until it awaits or returns
+         */
+        void resume()
+        {
+            mHandle.resume();
+        }
+
+        /** Check whether the handler returned
+         * @return bool: true if it returned
+         */
+        bool done() const
+        {
+            return mHandle.done();
+        }
+
+    private:
+
+        explicit RpcHandler(std::coroutine_handle<promise_type> handle): mHandle(handle){}
+
+        std::coroutine_handle<promise_type> mHandle;
+};
+
+/** Lets a bidirectional streaming rpc be handled by a coroutine instead of a
+ * process function: the handler reads the requests with co_await stream.read()
+ * and answers with co_await stream.write(reply). The stream is the job's
+ * state, the method's process function hands every request to deliver(), which
+ * starts the handler, JobType::MethodType::handle(), on the first one and
+ * resumes it on the next ones. Only touched from the job's strand, like the
+ * job itself.
+ * Once the handler returned and the client is done sending, the rpc is finished.
+ */
+template<typename JobType>
+class RpcStream
+{
+    public:
+
+        using Request = typename JobType::Request;
+        using Response = typename JobType::Response;
+
+        // Awaited by read(), ready right away if a request came in already
+        struct ReadAwaiter
+        {
+            RpcStream& stream;
+
+            bool await_ready() const
+            {
+                return stream.mRequestReady || stream.mClientDone;
+            }
+
+            void await_suspend(std::coroutine_handle<>)
+            {
+                stream.mReading = true;
+            }
+
+            const Request* await_resume()
+            {
+                stream.mRequestReady = false;
+                return stream.mRequest;
+            }
+        };
+
+        // Awaited by write(), the job keeps a copy of the response and writes it
+        // in order, so the handler goes on right away
+        struct WriteAwaiter
+        {
+            bool sent;
+
+            bool await_ready() const { return true; }
+            void await_suspend(std::coroutine_handle<>) {}
+            bool await_resume() const { return sent; }
+        };
+
+        /** RpcStream Constructor
+         * @param JobType* job: job of the rpc
+         */
+        explicit RpcStream(JobType* job): mJob(job)
+                                        , mRequest(nullptr)
+                                        , mRequestReady(false)
+                                        , mReading(false)
+                                        , mClientDone(false)
+                                        , mFinished(false){}
+
+        RpcStream(const RpcStream&) = delete;
+        RpcStream& operator=(const RpcStream&) = delete;
+
+        /** Accessor for the job of the rpc
+         * @return JobType*: the job
+         */
+        JobType* job() const
+        {
+            return mJob;
+        }
+
+        /** Wait for the next request
+         * @return ReadAwaiter: resumes with the request, nullptr once the client is done sending. The
+         * request stays valid until the next read.
+         */
+        ReadAwaiter read()
+        {
+            return ReadAwaiter{*this};
+        }
+
+        /** Send a response
+         * @param const Response& response: response to send
+         * @return WriteAwaiter: resumes with false if the rpc is gone
+         */
+        WriteAwaiter write(const Response& response)
+        {
+            return WriteAwaiter{mJob->SendResponse(&response)};
+        }
+
+        /** Hand a request over to the handler, called from the method's process function
+         * @param const Request* request: the request, nullptr once the client is done sending
+         */
+        void deliver(const Request* request)
+        {
+            mRequest = request;
+            mRequestReady = (request != nullptr);
+            mClientDone = (request == nullptr);
+
+            if (!mHandler)
+            {
+                mHandler = JobType::MethodType::handle(*this);
+                mHandler.resume();
+            }
+            else if (mReading)
+            {
+                mReading = false;
+                mHandler.resume();
+            }
+
+            // The job only finishes once the client is done, requests coming after the handler returned are dropped
+            if (mHandler.done() && mClientDone && !mFinished)
+            {
+                mFinished = true;
+                mJob->SendResponse(nullptr);
+            }
+        }
+
+    private:
+
+        JobType* mJob;
+        RpcHandler mHandler;
+
+        const Request* mRequest; // Request read() resumes with, owned by the job
+        bool mRequestReady; // mRequest was not read yet
+        bool mReading;      // The handler is suspended in read()
+        bool mClientDone;   // The client is done sending
+        bool mFinished;     // The rpc was finished
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include "PresenceFeed.hpp"
+#include "ServerOptions.hpp"
+#include "TagDispatcher.hpp"
+
+// Names of the methods as used in the --slots-<name> arguments and the stats
+static const char* const RPC_METHOD_NAMES[RPC_METHOD_COUNT] =
+{
+    "login", "logout", "send-message", "receive-message", "list", "list-users", "watch-presence", "chat"
+};
+
+/** Accessor for the name of a method
+ * @param RpcMethod method: method to name
+ * @return const char*: name of the method
+ */
+const char* rpcMethodName(RpcMethod method)
+{
+    return RPC_METHOD_NAMES[method];
+}
+
+/** ServerOptions Constructor, sets the defaults
+ */
+ServerOptions::ServerOptions(): address("0.0.0.0:50051")
+                              , engine(Engine::ASYNC)
+                              , statsInterval(0)
+                              , spinCount(TagDispatcher::DEFAULT_SPIN_COUNT)
+                              , threads(1)
+                              , queueCapacity(TagDispatcher::DEFAULT_QUEUE_CAPACITY)
+                              , dispatchMode(DispatchMode::HANDOFF)
+                              , workers(std::max(1u, std::thread::hardware_concurrency()))
+                              , affinity(AffinityMode::NONE)
+                              , drainTimeout(5)
+                              , userShards(0)
+                              , presenceWindow(PresenceFeed::DEFAULT_WINDOW_MS)
+{
+    std::fill(slots, slots + RPC_METHOD_COUNT, 1);
+}
+
+/** Parse a non-negative integer option value
+ * @param const char* value: text to parse
+ * @param int& result: where to store the value
+ * @return bool: true if valid, false if not
+ */
+static bool parseCount(const char* value, int& result)
+{
+    char* end = nullptr;
+    long parsed = std::strtol(value, &end, 10);
+    if(end == value || *end != '\0' || parsed < 0)
+        return false;
+
+    result = (int)parsed;
+    return true;
+}
+
+/** Fill in options from the command line, arguments are of the form --name=value
+ * @param int argc: Number of command line arguments
+ * @param char** argv: Command line arguments
+ * @param ServerOptions& options: options to fill in
+ * @return bool: true if every argument was understood, false if not
+ */
+bool parseServerOptions(int argc, char** argv, ServerOptions& options)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        std::string::size_type equals = arg.find('=');
+        std::string name = arg.substr(0, equals);
+        const char* value = (equals == std::string::npos) ? "" : argv[i] + equals + 1;
+
+        bool valid;
+        if(name == "--address")
+        {
+            options.address = value;
+            valid = !options.address.empty();
+        }
+        else if(name == "--engine")
+        {
+            valid = true;
+            if(std::strcmp(value, "async") == 0)
+                options.engine = ServerOptions::Engine::ASYNC;
+            else if(std::strcmp(value, "callback") == 0)
+                options.engine = ServerOptions::Engine::CALLBACK;
+            else
+                valid = false;
+        }
+        else if(name == "--stats-interval")
+        {
+            valid = parseCount(value, options.statsInterval);
+        }
+        else if(name == "--drain-timeout")
+        {
+            valid = parseCount(value, options.drainTimeout);
+        }
+        else if(name == "--spin-count")
+        {
+            valid = parseCount(value, options.spinCount);
+        }
+        else if(name == "--threads")
+        {
+            valid = parseCount(value, options.threads) && options.threads > 0;
+        }
+        else if(name == "--queue-capacity")
+        {
+            valid = parseCount(value, options.queueCapacity)
+                 && options.queueCapacity >= (int)TagDispatcher::MAX_BATCH;
+        }
+        else if(name == "--dispatch")
+        {
+            valid = true;
+            if(std::strcmp(value, "handoff") == 0)
+                options.dispatchMode = ServerOptions::DispatchMode::HANDOFF;
+            else if(std::strcmp(value, "inline") == 0)
+                options.dispatchMode = ServerOptions::DispatchMode::INLINE;
+            else if(std::strcmp(value, "executor") == 0)
+                options.dispatchMode = ServerOptions::DispatchMode::EXECUTOR;
+            else
+                valid = false;
+        }
+        else if(name == "--user-shards")
+        {
+            valid = parseCount(value, options.userShards);
+        }
+        else if(name == "--mailbox-capacity")
+        {
+            int capacity;
+            valid = parseCount(value, capacity) && capacity > 0;
+            if(valid)
+                options.mailbox.capacity = capacity;
+        }
+        else if(name == "--mailbox-overflow")
+        {
+            valid = true;
+            if(std::strcmp(value, "reject") == 0)
+                options.mailbox.overflow = MailboxPolicy::Overflow::REJECT;
+            else if(std::strcmp(value, "spill") == 0)
+                options.mailbox.overflow = MailboxPolicy::Overflow::SPILL;
+            else if(std::strcmp(value, "drop-oldest") == 0)
+                options.mailbox.overflow = MailboxPolicy::Overflow::DROP_OLDEST;
+            else
+                valid = false;
+        }
+        else if(name == "--presence-window")
+        {
+            valid = parseCount(value, options.presenceWindow) && options.presenceWindow > 0;
+        }
+        else if(name == "--idle-timeout")
+        {
+            valid = parseCount(value, options.eviction.idleTimeout);
+        }
+        else if(name == "--max-users")
+        {
+            int users;
+            valid = parseCount(value, users);
+            if(valid)
+                options.eviction.maxUsers = users;
+        }
+        else if(name == "--workers")
+        {
+            valid = parseCount(value, options.workers) && options.workers > 0;
+        }
+        else if(name == "--affinity")
+        {
+            valid = true;
+            if(std::strcmp(value, "none") == 0)
+                options.affinity = ServerOptions::AffinityMode::NONE;
+            else if(std::strcmp(value, "compact") == 0)
+                options.affinity = ServerOptions::AffinityMode::COMPACT;
+            else
+                valid = false;
+        }
+        else if(name == "--slots")
+        {
+            int slots;
+            valid = parseCount(value, slots) && slots > 0;
+            if(valid)
+                std::fill(options.slots, options.slots + RPC_METHOD_COUNT, slots);
+        }
+        else if(name.compare(0, 8, "--slots-") == 0)
+        {
+            valid = false;
+            for(int method = 0; method < RPC_METHOD_COUNT; method++)
+            {
+                if(name.compare(8, std::string::npos, RPC_METHOD_NAMES[method]) == 0)
+                    valid = parseCount(value, options.slots[method]) && options.slots[method] > 0;
+            }
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if(!valid)
+        {
+            std::cerr << "Invalid argument: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Print the accepted command line arguments
+ * @param const char* program: name the server was started with
+ */
+void printServerUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --address=HOST:PORT      address to listen on (default 0.0.0.0:50051)\n"
+              << "  --engine=ENGINE          async: RpcJob state machines over completion queues,\n"
+              << "                           callback: gRPC's callback reactors on its own threads (default async).\n"
+              << "                           The options from --spin-count to --affinity only apply to async\n"
+              << "  --stats-interval=SECONDS print server counters periodically, 0 disables (default 0)\n"
+              << "  --drain-timeout=SECONDS  time in-flight rpcs get to finish on SIGINT/SIGTERM (default 5)\n"
+              << "  --user-shards=N          shards of the user directory, each with its own lock, rounded up to a\n"
+              << "                           power of two (default: a few per core)\n"
+              << "  --mailbox-capacity=N     messages a user's mailbox holds before it overflows, rounded up to a\n"
+              << "                           power of two (default " << MailboxPolicy::DEFAULT_CAPACITY << ")\n"
+              << "  --mailbox-overflow=MODE  reject: refuse messages to a full mailbox,\n"
+              << "                           spill: queue them in an unbounded overflow list,\n"
+              << "                           drop-oldest: discard the oldest message to make room (default spill)\n"
+              << "  --presence-window=MS     time presence changes are gathered over before WatchPresence streams\n"
+              << "                           get them (default " << PresenceFeed::DEFAULT_WINDOW_MS << ")\n"
+              << "  --idle-timeout=SECONDS   time an offline user with no mail is kept since its last activity,\n"
+              << "                           0 keeps it whatever its age (default " << EvictionPolicy::DEFAULT_IDLE_TIMEOUT << ")\n"
+              << "  --max-users=N            users kept at most, the least recently active offline users with no\n"
+              << "                           mail are evicted above it, 0 for no cap (default 0)\n"
+              << "  --spin-count=N           spins before a worker thread parks (default "
+              << TagDispatcher::DEFAULT_SPIN_COUNT << ")\n"
+              << "  --threads=N              completion queues, each with a poller and a worker thread (default 1)\n"
+              << "  --queue-capacity=N       tags queued between a poller and its worker, at least "
+              << TagDispatcher::MAX_BATCH << " (default " << TagDispatcher::DEFAULT_QUEUE_CAPACITY << ")\n"
+              << "  --dispatch=MODE          handoff: process tags on a worker thread per queue,\n"
+              << "                           inline: process them on the polling thread,\n"
+              << "                           executor: process them on a shared work-stealing pool (default handoff)\n"
+              << "  --workers=N              executor threads (default: number of cores)\n"
+              << "  --affinity=MODE          none: let the threads float,\n"
+              << "                           compact: pin every poller, worker thread and executor worker to its own\n"
+              << "                           core, filling a NUMA node before the next (default none)\n"
+              << "  --slots=N                requests of every method kept posted per completion queue (default 1)\n"
+              << "  --slots-METHOD=N         the same for one method, overrides --slots when given after it.\n"
+              << "                           METHOD is one of";
+    for(int method = 0; method < RPC_METHOD_COUNT; method++)
+        std::cerr << " " << RPC_METHOD_NAMES[method];
+    std::cerr << "\n";
+}
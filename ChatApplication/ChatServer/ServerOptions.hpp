@@ -0,0 +1,46 @@
+#ifndef SERVER_OPTIONS_H
+#define SERVER_OPTIONS_H
+
+#include <string>
+#include "Mailbox.hpp"
+#include "UserEvictor.hpp"
+
+// The methods of the ChatServer service, used to configure them one by one
+enum RpcMethod {LOG_IN, LOG_OUT, SEND_MESSAGE, RECEIVE_MESSAGE, LIST, LIST_USERS, WATCH_PRESENCE, CHAT, RPC_METHOD_COUNT};
+
+const char* rpcMethodName(RpcMethod method);
+
+/** Runtime configuration of the server, filled in from the command line
+ */
+struct ServerOptions
+{
+    // How the service is served: ASYNC drives RpcJobs over completion queues, CALLBACK uses gRPC's reactors
+    enum class Engine {ASYNC, CALLBACK};
+    // Where the tags coming out of a completion queue are processed
+    enum class DispatchMode {HANDOFF, INLINE, EXECUTOR};
+    // How the server threads are placed on the cpus
+    enum class AffinityMode {NONE, COMPACT};
+
+    ServerOptions();
+
+    std::string address;    // Address the server listens on
+    Engine engine;          // The options from spinCount to affinity only apply to the ASYNC engine
+    int statsInterval;      // Seconds between printing server counters, 0 disables it
+    int spinCount;          // Iterations a worker thread spins for work before parking
+    int threads;            // Number of completion queues, each with its own poller and worker thread
+    int queueCapacity;      // Tags a poller can hand over to its worker before it has to wait
+    DispatchMode dispatchMode; // HANDOFF to a worker thread per queue, INLINE on the poller, or EXECUTOR on a shared pool
+    int workers;            // Threads in the work-stealing executor, used with DispatchMode::EXECUTOR
+    int slots[RPC_METHOD_COUNT]; // Requests of each method kept posted on every completion queue
+    AffinityMode affinity;  // NONE lets the threads float, COMPACT pins each one to a core, filling a NUMA node before the next
+    int drainTimeout;       // Seconds in-flight rpcs get to finish on shutdown before they are cancelled
+    int userShards;         // Shards of the user directory, 0 picks a few per core
+    MailboxPolicy mailbox;  // Capacity of every user's mailbox and what to do with a message to a full one
+    int presenceWindow;     // Milliseconds the presence changes are gathered over before WatchPresence streams get them
+    EvictionPolicy eviction; // When idle offline users with an empty mailbox are evicted
+};
+
+bool parseServerOptions(int argc, char** argv, ServerOptions& options);
+void printServerUsage(const char* program);
+
+#endif
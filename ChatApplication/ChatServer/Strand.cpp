@@ -0,0 +1,76 @@
+#include "Strand.hpp"
+
+thread_local Strand* Strand::tCurrent = nullptr;
+
+/** Strand Constructor
+ * @param WorkStealingExecutor* executor: executor the tasks run on, nullptr to run them on the calling threads
+ */
+Strand::Strand(WorkStealingExecutor* executor): mExecutor(executor)
+                                              , mScheduled(false)
+                                              , mClosed(false){}
+
+/** Drop the queued tasks and refuse new ones, should be called from inside the strand
+ */
+void Strand::close()
+{
+    std::deque<Task> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mClosed = true;
+        dropped.swap(mTasks);
+    }
+}
+
+/** Check whether the current thread is running this strand's tasks
+ * @return bool: true if called from inside the strand
+ */
+bool Strand::runningInThisThread() const
+{
+    return tCurrent == this;
+}
+
+/** Hand a drain of the strand to the executor
+ */
+void Strand::schedule()
+{
+    std::shared_ptr<Strand> self = shared_from_this();
+    mExecutor->submit([self]{ self->drain(); });
+}
+
+/** Run the queued tasks in order until there are none left. On the executor it
+ * gives the worker back after MAX_TASKS_PER_TURN tasks and carries on once the
+ * tasks already queued on that worker ran, or on another worker that steals it.
+ */
+void Strand::drain()
+{
+    // Keeps the strand alive even if a task destroys its owner
+    std::shared_ptr<Strand> self = shared_from_this();
+    Strand* previous = tCurrent;
+    tCurrent = this;
+
+    for(int turn = 0; ; turn++)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if(mTasks.empty())
+            {
+                mScheduled = false;
+                break;
+            }
+            if(mExecutor && turn == MAX_TASKS_PER_TURN)
+            {
+                // Still scheduled, no other thread starts draining meanwhile. Yielded rather than
+                // submitted, a worker takes its newest task first and would pick the strand right back up.
+                lock.unlock();
+                mExecutor->yield([self]{ self->drain(); });
+                break;
+            }
+            task = std::move(mTasks.front());
+            mTasks.pop_front();
+        }
+        task();
+    }
+
+    tCurrent = previous;
+}
@@ -0,0 +1,97 @@
+#ifndef STRAND_H
+#define STRAND_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include "WorkStealingExecutor.hpp"
+
+/** Serialized execution context. The tasks given to a strand run one at a time
+ * and in the order they were given, whatever thread hands them over, so the
+ * state they touch needs no lock of its own.
+ * With an executor the tasks run on its workers. Without one they run on the
+ * thread that finds the strand idle, which keeps draining it until it is empty.
+ * Always held through a shared_ptr, a task may destroy the object that owns the
+ * strand. The owner closes it when it goes away and later tasks are dropped.
+ */
+class Strand : public std::enable_shared_from_this<Strand>
+{
+    public:
+
+        using Task = WorkStealingExecutor::Task;
+
+        // Tasks run in one go before the strand lets other strands have the executor worker
+        static const int MAX_TASKS_PER_TURN = 64;
+
+        explicit Strand(WorkStealingExecutor* executor);
+
+        template<typename Function>
+        bool dispatch(Function&& function);
+        void close();
+        bool runningInThisThread() const;
+
+    private:
+
+        void drain();
+        void schedule();
+
+        // Strand whose tasks the current thread is running, if any
+        static thread_local Strand* tCurrent;
+
+        WorkStealingExecutor* mExecutor;
+        std::mutex mMutex;
+        std::deque<Task> mTasks;
+        bool mScheduled; // Some thread is running the strand's tasks, or a drain is submitted to the executor
+        bool mClosed;
+};
+
+/** Run a function on the strand. Called from inside the strand it runs right
+ * away, otherwise it is queued behind the tasks already given to the strand,
+ * or run on this thread right away if there is no executor and nothing queued.
+ * @param Function&& function: callable taking no arguments
+ * @return bool: false if the strand is closed and the function was dropped
+ */
+template<typename Function>
+bool Strand::dispatch(Function&& function)
+{
+    if (runningInThisThread())
+    {
+        if (mClosed)
+            return false;
+        function();
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mClosed)
+        return false;
+
+    if (mScheduled || mExecutor)
+    {
+        mTasks.emplace_back(std::forward<Function>(function));
+        if (!mScheduled)
+        {
+            mScheduled = true;
+            lock.unlock();
+            schedule();
+        }
+        return true;
+    }
+
+    // Idle and no executor, run it here without wrapping it in a Task
+    mScheduled = true;
+    lock.unlock();
+
+    std::shared_ptr<Strand> self = shared_from_this();
+    Strand* previous = tCurrent;
+    tCurrent = this;
+    function();
+    tCurrent = previous;
+
+    // Pick up whatever was queued meanwhile
+    drain();
+    return true;
+}
+
+#endif
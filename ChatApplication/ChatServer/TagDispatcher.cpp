@@ -0,0 +1,183 @@
+#include <thread>
+#include "TagDispatcher.hpp"
+
+/** Hint to the cpu that we are in a spin-wait loop
+ */
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/** TagDispatcher Constructor
+ * @param int spinCount: iterations to spin for new tags before parking
+ * @param int queueCapacity: tags that can be queued before producers have to wait
+ */
+TagDispatcher::TagDispatcher(int spinCount, int queueCapacity): mSpinCount(spinCount)
+                                                              , mQueue(queueCapacity)
+                                                              , mSleeping(false)
+                                                              , mStopping(false)
+                                                              , mWakeups(0)
+                                                              , mSpins(0)
+                                                              , mSpinHits(0)
+                                                              , mBatches(0)
+                                                              , mDrainedTags(0)
+                                                              , mMaxBatch(0)
+                                                              , mFullWaits(0){}
+
+/** Queue a tag to be processed on the application thread, called from the
+ * completion queue thread. Only signals the condition variable if the
+ * application thread is actually parked.
+ * @param const TagInfo& tagInfo: tag received from the completion queue
+ */
+void TagDispatcher::push(const TagInfo& tagInfo)
+{
+    while(!mQueue.tryPush(tagInfo))
+        waitForRoom();
+
+    wakeConsumer();
+}
+
+/** Queue several tags at once
+ * @param TagInfo* tags: tags received from the completion queue
+ * @param size_t count: number of tags, at most MAX_BATCH
+ */
+void TagDispatcher::pushBatch(TagInfo* tags, size_t count)
+{
+    while(!mQueue.tryPushBatch(tags, count))
+        waitForRoom();
+
+    wakeConsumer();
+}
+
+/** Back off while the application thread makes room in a full queue
+ */
+void TagDispatcher::waitForRoom()
+{
+    mFullWaits.fetch_add(1, std::memory_order_relaxed);
+    wakeConsumer();
+    std::this_thread::yield();
+}
+
+/** Wake the application thread up if it is parked
+ */
+void TagDispatcher::wakeConsumer()
+{
+    // Pairs with the fence in waitForTags: either we see the consumer going
+    // to sleep, or the consumer sees the tag we just pushed
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!mSleeping.load(std::memory_order_relaxed))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+    }
+    mCondition.notify_one();
+}
+
+/** Wait until at least one tag is available and take up to MAX_BATCH of them
+ * @param TagInfo* tags: where to store the tags, room for MAX_BATCH
+ * @return size_t: number of tags taken, 0 only once stopping
+ */
+size_t TagDispatcher::waitForTags(TagInfo* tags)
+{
+    // Spin briefly first, the completion queue thread usually has more work
+    // for us shortly after we run dry and parking costs a syscall both ways
+    int spins = 0;
+    size_t count;
+    while((count = mQueue.tryPopBatch(tags, MAX_BATCH)) == 0
+       && spins < mSpinCount)
+    {
+        cpuRelax();
+        ++spins;
+    }
+    mSpins.fetch_add(spins, std::memory_order_relaxed);
+
+    if(count)
+    {
+        if(spins)
+            mSpinHits.fetch_add(1, std::memory_order_relaxed);
+        return count;
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mSleeping.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    mCondition.wait(lock, [this]{ return !mQueue.empty() || mStopping.load(std::memory_order_relaxed); });
+    mSleeping.store(false, std::memory_order_relaxed);
+    lock.unlock();
+    mWakeups.fetch_add(1, std::memory_order_relaxed);
+
+    return mQueue.tryPopBatch(tags, MAX_BATCH);
+}
+
+/** Loop to process tags until stopped, should be run in separate thread
+ */
+void TagDispatcher::run()
+{
+    TagInfo tags[MAX_BATCH];
+    while(true)
+    {
+        size_t batchSize = waitForTags(tags);
+        if(batchSize == 0)
+            return;
+
+        mBatches.fetch_add(1, std::memory_order_relaxed);
+        mDrainedTags.fetch_add(batchSize, std::memory_order_relaxed);
+        if(batchSize > mMaxBatch.load(std::memory_order_relaxed))
+            mMaxBatch.store(batchSize, std::memory_order_relaxed);
+
+        for(size_t i = 0; i < batchSize; i++)
+            processTag(tags[i].tag, tags[i].ok);
+    }
+}
+
+/** Make run() return once every tag pushed so far is processed, can be called from any thread
+ */
+void TagDispatcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping.store(true, std::memory_order_relaxed);
+    }
+    mCondition.notify_one();
+}
+
+/** Accessor for the dispatcher counters
+ * @return Stats: snapshot of the counters
+ */
+TagDispatcher::Stats TagDispatcher::getStats() const
+{
+    Stats stats;
+    stats.wakeups = mWakeups.load(std::memory_order_relaxed);
+    stats.spins = mSpins.load(std::memory_order_relaxed);
+    stats.spinHits = mSpinHits.load(std::memory_order_relaxed);
+    stats.batches = mBatches.load(std::memory_order_relaxed);
+    stats.tags = mDrainedTags.load(std::memory_order_relaxed);
+    stats.maxBatch = mMaxBatch.load(std::memory_order_relaxed);
+    stats.depth = mQueue.depth();
+    stats.highWater = mQueue.highWater();
+    stats.fullWaits = mFullWaits.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/** Print dispatcher counters
+ * @param std::ostream& out: stream to print to
+ * @param const Stats& stats: counters to print
+ * @return std::ostream&: the stream printed to
+ */
+std::ostream& operator<<(std::ostream& out, const TagDispatcher::Stats& stats)
+{
+    out << "tags=" << stats.tags
+        << " batches=" << stats.batches
+        << " avgBatch=" << (stats.batches ? (double)stats.tags / stats.batches : 0.0)
+        << " maxBatch=" << stats.maxBatch
+        << " wakeups=" << stats.wakeups
+        << " spins=" << stats.spins
+        << " spinHits=" << stats.spinHits
+        << " depth=" << stats.depth
+        << " highWater=" << stats.highWater
+        << " fullWaits=" << stats.fullWaits;
+    return out;
+}
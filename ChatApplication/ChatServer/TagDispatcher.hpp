@@ -0,0 +1,95 @@
+#ifndef TAG_DISPATCHER_H
+#define TAG_DISPATCHER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include "MpscQueue.hpp"
+
+class RpcJob;
+
+// Events of an rpc that come out of the completion queue
+enum class RpcEvent : uint8_t {INIT, READ, WRITE, FINISH, DONE};
+
+// We add an 'RpcTag' to the completion queue for each event. The tags are members of the job they belong to,
+// so asking gRPC for an event allocates nothing, and processTag() hands the event back to the job.
+struct RpcTag
+{
+    RpcJob* job;    // Job the event belongs to
+    RpcEvent event; // Which of the job's events this is
+};
+
+// Process an event that came out of the completion queue, defined along with RpcJob
+void processTag(RpcTag* tag, bool ok);
+
+struct TagInfo
+{
+    RpcTag* tag; // The tag of the incoming event
+    bool ok; // The result of tag processing as indicated by gRPC library. Calling it 'ok' to be in sync with other gRPC examples.
+};
+
+/** Hands tags from the completion queue thread over to the application thread
+ * through a bounded lock-free queue. The application thread spins for a short
+ * while when it runs out of work and then parks on a condition variable until
+ * the completion queue thread pushes more tags. Tags are always drained in batches.
+ */
+class TagDispatcher
+{
+    public:
+
+        // Counters used to tune the spin count and the queue capacity
+        struct Stats
+        {
+            uint64_t wakeups;   // Times the application thread was woken up after parking
+            uint64_t spins;     // Spin iterations spent waiting for work before parking
+            uint64_t spinHits;  // Times spinning found work and parking was avoided
+            uint64_t batches;   // Number of batches drained
+            uint64_t tags;      // Number of tags drained
+            uint64_t maxBatch;  // Largest batch drained at once
+            uint64_t depth;     // Tags queued right now
+            uint64_t highWater; // Most tags ever queued at once
+            uint64_t fullWaits; // Times a producer found the queue full and had to wait
+        };
+
+        static const int DEFAULT_SPIN_COUNT = 2000;
+        static const int DEFAULT_QUEUE_CAPACITY = 4096;
+        static const size_t MAX_BATCH = 256;
+
+        explicit TagDispatcher(int spinCount = DEFAULT_SPIN_COUNT, int queueCapacity = DEFAULT_QUEUE_CAPACITY);
+
+        void push(const TagInfo& tagInfo);
+        void pushBatch(TagInfo* tags, size_t count);
+        void run();
+        void stop();
+        Stats getStats() const;
+
+    private:
+        size_t waitForTags(TagInfo* tags);
+        void waitForRoom();
+        void wakeConsumer();
+
+        const int mSpinCount;
+
+        MpscQueue<TagInfo> mQueue;
+
+        // Only used to park the application thread, producers take it only when it is asleep
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        std::atomic<bool> mSleeping;
+        std::atomic<bool> mStopping; // run() returns once the queue is empty
+
+        std::atomic<uint64_t> mWakeups;
+        std::atomic<uint64_t> mSpins;
+        std::atomic<uint64_t> mSpinHits;
+        std::atomic<uint64_t> mBatches;
+        std::atomic<uint64_t> mDrainedTags;
+        std::atomic<uint64_t> mMaxBatch;
+        std::atomic<uint64_t> mFullWaits;
+};
+
+std::ostream& operator<<(std::ostream& out, const TagDispatcher::Stats& stats);
+
+#endif
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "UserDirectory.hpp"
+
+// Shards per core, enough that two busy threads seldom pick the same one
+static const size_t SHARDS_PER_CORE = 4;
+static const size_t MIN_SHARDS = 16;
+
+/** Round a count up to a power of two
+ * @param size_t count: count to round
+ * @return size_t: the smallest power of two not below count
+ */
+static size_t roundUpToPowerOfTwo(size_t count)
+{
+    size_t power = 1;
+    while(power < count)
+        power <<= 1;
+    return power;
+}
+
+/** UserDirectory Constructor
+ * @param size_t shards: number of shards, rounded up to a power of two, 0 picks defaultShardCount()
+ * @param const MailboxPolicy& mailbox: size and overflow behavior of the users' mailboxes
+ */
+UserDirectory::UserDirectory(size_t shards, const MailboxPolicy& mailbox): mMailboxPolicy(mailbox)
+{
+    size_t count = roundUpToPowerOfTwo(shards ? shards : defaultShardCount());
+    mShards.reset(new Shard[count]);
+    mShardMask = count - 1;
+}
+
+/** UserDirectory Destructor, deallocates the users, and the removed ones no guard holds anymore
+ */
+UserDirectory::~UserDirectory()
+{
+    for(size_t i = 0; i <= mShardMask; i++)
+        mShards[i].users.forEach([](UserNode* node) { delete node; });
+    EpochReclaimer::instance().reclaim();
+}
+
+/** Shard count for this machine, a few per core so contention stays low as cores are added
+ * @return size_t: number of shards
+ */
+size_t UserDirectory::defaultShardCount()
+{
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    return roundUpToPowerOfTwo(std::max(MIN_SHARDS, cores * SHARDS_PER_CORE));
+}
+
+/** Hash a user name, for both the shard and the table in it
+ * @param const std::string& name: name of the user
+ * @return uint64_t: the hash
+ */
+uint64_t UserDirectory::hashOf(const std::string& name)
+{
+    // Remix so that the low bits the tables use and the high bits the shards use are both spread
+    uint64_t hash = std::hash<std::string>()(name);
+    return (hash ^ (hash >> 32)) * 0x9E3779B97F4A7C15ull;
+}
+
+/** Pick the shard of a user
+ * @param uint64_t hash: hash of the name of the user
+ * @return Shard&: the shard holding the user if it exists
+ */
+UserDirectory::Shard& UserDirectory::shardFor(uint64_t hash) const
+{
+    return mShards[(hash >> 40) & mShardMask];
+}
+
+/** Look a user up, hold an EpochGuard while using the node
+ * @param const std::string& name: name of the user
+ * @return UserNode*: the user, nullptr if it never logged in or was removed
+ */
+UserNode* UserDirectory::find(const std::string& name) const
+{
+    uint64_t hash = hashOf(name);
+    const Shard& shard = shardFor(hash);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.users.find(name, hash);
+}
+
+/** Look a user up by id, hold an EpochGuard while using the node
+ * @param uint32_t id: id the user got when it was created
+ * @return UserNode*: the user, nullptr if no user has that id anymore
+ */
+UserNode* UserDirectory::find(uint32_t id) const
+{
+    return mIds.find(id);
+}
+
+/** Create a user unless one with that name exists, the new user is offline
+ * @param const std::string& name: name of the user
+ * @return std::pair<UserNode*, bool>: the user, and true if it was just created,
+ * nullptr if it does not exist and no id is left for it
+ */
+std::pair<UserNode*, bool> UserDirectory::insertIfAbsent(const std::string& name)
+{
+    uint64_t hash = hashOf(name);
+    Shard& shard = shardFor(hash);
+    {
+        // Most names logging in exist already, which readers can tell
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        if(UserNode* existing = shard.users.find(name, hash))
+            return std::make_pair(existing, false);
+    }
+
+    // Losing the race below leaves an id no one gets, which find() tells apart
+    uint32_t id = mIds.nextId();
+    if(id == UserIdTable::NO_ID)
+        return std::make_pair(nullptr, false);
+
+    std::unique_ptr<UserNode> newNode(new UserNode(name, id, mMailboxPolicy));
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    UserNode* node = shard.users.insert(name, hash, newNode.get());
+    // Someone else created it between the two locks
+    if(node != newNode.get())
+        return std::make_pair(node, false);
+
+    mIds.publish(node);
+    return std::make_pair(newNode.release(), true);
+}
+
+/** Count the users
+ * @return size_t: number of users in the directory
+ */
+size_t UserDirectory::size() const
+{
+    size_t count = 0;
+    for(size_t i = 0; i <= mShardMask; i++)
+    {
+        std::shared_lock<std::shared_mutex> lock(mShards[i].mutex);
+        count += mShards[i].users.size();
+    }
+    return count;
+}
+
+/** Accessor for the number of shards
+ * @return size_t: number of shards
+ */
+size_t UserDirectory::shardCount() const
+{
+    return mShardMask + 1;
+}
+
+/** Count the users and the memory the tables take
+ * @return UserDirectoryStats: snapshot of the counters, each shard is read on its own
+ */
+UserDirectoryStats UserDirectory::getStats() const
+{
+    UserDirectoryStats stats = {0, shardCount(), 0, mIds.memoryUsage()};
+    for(size_t i = 0; i <= mShardMask; i++)
+    {
+        std::shared_lock<std::shared_mutex> lock(mShards[i].mutex);
+        stats.users += mShards[i].users.size();
+        stats.slots += mShards[i].users.capacity();
+        stats.bytes += sizeof(Shard) + mShards[i].users.memoryUsage();
+    }
+    return stats;
+}
+
+/** Print the user directory counters
+ * @param std::ostream& out: stream to print to
+ * @param const UserDirectoryStats& stats: counters to print
+ * @return std::ostream&: the stream printed to
+ */
+std::ostream& operator<<(std::ostream& out, const UserDirectoryStats& stats)
+{
+    out << "users=" << stats.users << " shards=" << stats.shards << " slots=" << stats.slots
+        << " tableBytes=" << stats.bytes;
+    if(stats.users > 0)
+        out << " bytesPerUser=" << stats.bytes / stats.users;
+    return out;
+}
@@ -0,0 +1,129 @@
+#ifndef USER_DIRECTORY_H
+#define USER_DIRECTORY_H
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "EpochReclaimer.hpp"
+#include "FlatUserTable.hpp"
+#include "UserIdTable.hpp"
+#include "UserNode.hpp"
+
+/** Size of the user directory
+ */
+struct UserDirectoryStats
+{
+    size_t users;  // Users in the directory, evicted ones are gone
+    size_t shards;
+    size_t slots;  // Table slots, full or not
+    size_t bytes;  // Memory of the tables and the id array, not counting the users themselves
+};
+
+std::ostream& operator<<(std::ostream& out, const UserDirectoryStats& stats);
+
+/** Concurrent map from user name to UserNode, split into shards that each have
+ * their own reader-writer lock and FlatUserTable. Lookups only share the lock of one shard and
+ * inserting a user only excludes the users of its shard, so rpcs of different
+ * users rarely wait on each other. Every user also gets a numeric id, looked up
+ * in a UserIdTable without hashing or locking. The nodes synchronize their own
+ * state. A removed node is retired to the EpochReclaimer, so a node found inside
+ * an EpochGuard stays valid until the guard ends, whoever removes it meanwhile.
+ */
+class UserDirectory
+{
+    public:
+
+        explicit UserDirectory(size_t shards = 0, const MailboxPolicy& mailbox = MailboxPolicy());
+        ~UserDirectory();
+
+        UserDirectory(const UserDirectory&) = delete;
+        UserDirectory& operator=(const UserDirectory&) = delete;
+
+        UserNode* find(const std::string& name) const;
+        UserNode* find(uint32_t id) const;
+        std::pair<UserNode*, bool> insertIfAbsent(const std::string& name);
+        template<typename Confirm>
+        bool erase(UserNode* node, Confirm&& confirm);
+        template<typename Function>
+        void forEach(Function&& function) const;
+
+        size_t size() const;
+        size_t shardCount() const;
+        UserDirectoryStats getStats() const;
+
+        static size_t defaultShardCount();
+
+    private:
+
+        // On a cache line of its own, so locking a shard does not slow its neighbours down
+        struct alignas(64) Shard
+        {
+            mutable std::shared_mutex mutex; // Shared by lookups, exclusive to insertions and removals
+            FlatUserTable users;
+        };
+
+        static uint64_t hashOf(const std::string& name);
+        Shard& shardFor(uint64_t hash) const;
+
+        std::unique_ptr<Shard[]> mShards;
+        size_t mShardMask; // The shard count is a power of two
+        UserIdTable mIds;
+        MailboxPolicy mMailboxPolicy; // Given to every new user
+};
+
+/** Remove a user, after a last check made with its shard locked so that no
+ * one can find it meanwhile. The node is freed once no guard can hold it.
+ * @param UserNode* node: the user, found inside an EpochGuard still held
+ * @param Confirm&& confirm: callable taking a UserNode& and returning false to keep the user
+ * @return bool: true if the user was removed
+ */
+template<typename Confirm>
+bool UserDirectory::erase(UserNode* node, Confirm&& confirm)
+{
+    uint64_t hash = hashOf(node->getName());
+    Shard& shard = shardFor(hash);
+    {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        // Someone else removed it already
+        if(shard.users.find(node->getName(), hash) != node || !confirm(*node))
+            return false;
+
+        shard.users.erase(node->getName(), hash);
+        mIds.clear(node->getId());
+    }
+
+    EpochReclaimer::instance().retire(node);
+    return true;
+}
+
+/** Call a function on every user. A shard is only locked while its nodes are
+ * collected and the function runs without any lock, so writers wait for one
+ * shard at most. Users inserted or removed meanwhile may or may not be visited.
+ * @param Function&& function: callable taking a UserNode&
+ */
+template<typename Function>
+void UserDirectory::forEach(Function&& function) const
+{
+    // The nodes collected stay valid after their shard is unlocked
+    EpochGuard guard;
+    std::vector<UserNode*> nodes;
+    for(size_t i = 0; i <= mShardMask; i++)
+    {
+        nodes.clear();
+        {
+            std::shared_lock<std::shared_mutex> lock(mShards[i].mutex);
+            nodes.reserve(mShards[i].users.size());
+            mShards[i].users.forEach([&nodes](UserNode* node) { nodes.push_back(node); });
+        }
+
+        for(UserNode* node : nodes)
+            function(*node);
+    }
+}
+
+#endif
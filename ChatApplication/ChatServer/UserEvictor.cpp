@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <fstream>
+#include <unistd.h>
+#include "ChatCore.hpp"
+#include "UserEvictor.hpp"
+
+/** Pick the time between two sweeps, a fraction of the timeout so users go soon after it
+ * @param const EvictionPolicy& policy: the policy swept for
+ * @return std::chrono::milliseconds: the interval
+ */
+static std::chrono::milliseconds sweepInterval(const EvictionPolicy& policy)
+{
+    // A cap alone is enforced within a second
+    if(policy.idleTimeout <= 0)
+        return std::chrono::milliseconds(1000);
+    return std::chrono::milliseconds(std::clamp(policy.idleTimeout * 1000ll / 8, 1000ll, 60000ll));
+}
+
+/** Read the resident memory of the process
+ * @return size_t: resident bytes, 0 if /proc can't be read
+ */
+static size_t residentBytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    if(!(statm >> pages >> resident))
+        return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/** UserEvictor Constructor, starts the thread unless the policy never evicts
+ * @param ChatCore& core: core whose users are evicted, it outlives the evictor
+ * @param const EvictionPolicy& policy: timeout and cap of the users
+ */
+UserEvictor::UserEvictor(ChatCore& core, const EvictionPolicy& policy): mCore(core)
+                                                                      , mPolicy(policy)
+                                                                      , mInterval(sweepInterval(policy))
+                                                                      , mStopping(false)
+                                                                      , mSweeps(0)
+                                                                      , mEvicted(0)
+{
+    if(mPolicy.idleTimeout > 0 || mPolicy.maxUsers > 0)
+        mThread = std::thread(&UserEvictor::run, this);
+}
+
+/** UserEvictor Destructor, stops the thread
+ */
+UserEvictor::~UserEvictor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_one();
+    if(mThread.joinable())
+        mThread.join();
+}
+
+/** Body of the thread, sweeps once per interval
+ */
+void UserEvictor::run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        mCondition.wait_for(lock, mInterval, [this]{ return mStopping; });
+        if(mStopping)
+            return;
+
+        lock.unlock();
+        mEvicted.fetch_add(mCore.evictIdleUsers(mPolicy), std::memory_order_relaxed);
+        mSweeps.fetch_add(1, std::memory_order_relaxed);
+        // The users of this sweep wait for the next one if a reader still holds them
+        EpochReclaimer::instance().reclaim();
+        lock.lock();
+    }
+}
+
+/** Accessor for the eviction counters
+ * @return EvictionStats: snapshot of the counters
+ */
+EvictionStats UserEvictor::getStats() const
+{
+    EvictionStats stats;
+    stats.sweeps = mSweeps.load(std::memory_order_relaxed);
+    stats.evicted = mEvicted.load(std::memory_order_relaxed);
+    stats.reclaimer = EpochReclaimer::instance().getStats();
+    stats.residentBytes = residentBytes();
+    return stats;
+}
+
+/** Print the eviction counters
+ * @param std::ostream& out: stream to print to
+ * @param const EvictionStats& stats: counters to print
+ * @return std::ostream&: the stream printed to
+ */
+std::ostream& operator<<(std::ostream& out, const EvictionStats& stats)
+{
+    out << "sweeps=" << stats.sweeps << " evicted=" << stats.evicted << " " << stats.reclaimer
+        << " rssKb=" << stats.residentBytes / 1024;
+    return out;
+}
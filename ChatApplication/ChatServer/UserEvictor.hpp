@@ -0,0 +1,76 @@
+#ifndef USER_EVICTOR_H
+#define USER_EVICTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include "EpochReclaimer.hpp"
+
+class ChatCore;
+
+/** When offline users are evicted. Only users with an empty mailbox are, so no message is lost.
+ */
+struct EvictionPolicy
+{
+    static const int DEFAULT_IDLE_TIMEOUT = 3600;
+
+    EvictionPolicy(): idleTimeout(DEFAULT_IDLE_TIMEOUT)
+                    , maxUsers(0){}
+
+    int idleTimeout; // Seconds an offline user is kept since its last activity, 0 keeps it whatever its age
+    size_t maxUsers; // Users above this are evicted, least recently active first, 0 for no cap
+};
+
+/** Counters of the UserEvictor, with the memory they are meant to keep flat
+ */
+struct EvictionStats
+{
+    uint64_t sweeps;              // Passes over the users so far
+    uint64_t evicted;             // Users evicted so far
+    EpochReclaimerStats reclaimer; // Evicted users waiting to be freed
+    size_t residentBytes;         // Resident memory of the process, 0 if it can't be read
+};
+
+std::ostream& operator<<(std::ostream& out, const EvictionStats& stats);
+
+/** Evicts the idle offline users of a ChatCore from a thread of its own. Each
+ * sweep evicts the users idle past the timeout and then, least recently active
+ * first, those over the cap, and frees the users evicted before that no reader
+ * can still hold. The thread only runs if the policy evicts anyone.
+ */
+class UserEvictor
+{
+    public:
+
+        UserEvictor(ChatCore& core, const EvictionPolicy& policy);
+        ~UserEvictor();
+
+        UserEvictor(const UserEvictor&) = delete;
+        UserEvictor& operator=(const UserEvictor&) = delete;
+
+        EvictionStats getStats() const;
+
+    private:
+
+        void run();
+
+        ChatCore& mCore;
+        const EvictionPolicy mPolicy;
+        const std::chrono::milliseconds mInterval; // Time between two sweeps
+
+        std::mutex mMutex; // Guards mStopping
+        std::condition_variable mCondition;
+        bool mStopping;
+
+        std::atomic<uint64_t> mSweeps;
+        std::atomic<uint64_t> mEvicted;
+
+        std::thread mThread; // Started last, once the members above are set up
+};
+
+#endif
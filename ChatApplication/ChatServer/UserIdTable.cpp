@@ -0,0 +1,101 @@
+#include "UserIdTable.hpp"
+
+/** UserIdTable Constructor, no segment is allocated yet
+ */
+UserIdTable::UserIdTable(): mNextId(1)
+{
+    for(auto& segment : mSegments)
+        segment.store(nullptr, std::memory_order_relaxed);
+}
+
+/** UserIdTable Destructor, the nodes belong to the directory
+ */
+UserIdTable::~UserIdTable()
+{
+    for(auto& segment : mSegments)
+        delete[] segment.load(std::memory_order_relaxed);
+}
+
+/** Hand out the next id. The counter stops at NO_ID after wrapping around
+ * instead of reusing ids, NO_ID has no segment
+ * @return uint32_t: an id no other user has, NO_ID if all ids were handed out
+ */
+uint32_t UserIdTable::nextId()
+{
+    uint32_t id = mNextId.load(std::memory_order_relaxed);
+    while(id != NO_ID && !mNextId.compare_exchange_weak(id, id + 1, std::memory_order_relaxed));
+    return id;
+}
+
+/** Get a segment, allocating it if no id used it yet
+ * @param size_t index: index of the segment
+ * @return std::atomic<UserNode*>*: the segment, 2^index slots
+ */
+std::atomic<UserNode*>* UserIdTable::segment(size_t index)
+{
+    std::atomic<UserNode*>* slots = mSegments[index].load(std::memory_order_acquire);
+    if(slots)
+        return slots;
+
+    std::atomic<UserNode*>* fresh = new std::atomic<UserNode*>[(size_t)1 << index]();
+    // Another id of the segment may have allocated it meanwhile
+    if(mSegments[index].compare_exchange_strong(slots, fresh, std::memory_order_acq_rel))
+        return fresh;
+
+    delete[] fresh;
+    return slots;
+}
+
+/** Make a node findable by its id
+ * @param UserNode* node: node whose id came from nextId(), not NO_ID
+ */
+void UserIdTable::publish(UserNode* node)
+{
+    uint32_t id = node->getId();
+    size_t index = segmentOf(id);
+    segment(index)[id - ((uint32_t)1 << index)].store(node, std::memory_order_release);
+}
+
+/** Make a removed node unfindable by its id, readers that found it already keep it
+ * @param uint32_t id: id of the node, published before
+ */
+void UserIdTable::clear(uint32_t id)
+{
+    if(id == NO_ID)
+        return;
+
+    size_t index = segmentOf(id);
+    segment(index)[id - ((uint32_t)1 << index)].store(nullptr, std::memory_order_seq_cst);
+}
+
+/** Look a user up by id
+ * @param uint32_t id: id of the user
+ * @return UserNode*: the user, nullptr if no user has that id
+ */
+UserNode* UserIdTable::find(uint32_t id) const
+{
+    // segmentOf() is undefined for NO_ID
+    if(id == NO_ID)
+        return nullptr;
+
+    size_t index = segmentOf(id);
+    std::atomic<UserNode*>* slots = mSegments[index].load(std::memory_order_acquire);
+    if(!slots)
+        return nullptr;
+
+    return slots[id - ((uint32_t)1 << index)].load(std::memory_order_acquire);
+}
+
+/** Bytes taken by the allocated segments
+ * @return size_t: size of the segments
+ */
+size_t UserIdTable::memoryUsage() const
+{
+    size_t bytes = sizeof(mSegments);
+    for(size_t i = 0; i < SEGMENT_COUNT; i++)
+    {
+        if(mSegments[i].load(std::memory_order_relaxed))
+            bytes += ((size_t)1 << i) * sizeof(std::atomic<UserNode*>);
+    }
+    return bytes;
+}
@@ -0,0 +1,49 @@
+#ifndef USER_ID_TABLE_H
+#define USER_ID_TABLE_H
+
+#include <atomic>
+#include <cstdint>
+#include "UserNode.hpp"
+
+/** Array from user id to UserNode, read without any lock. Ids are handed out
+ * in order starting at 1, and the array grows by segments that double in size
+ * so a node never moves once published: id i lives in segment floor(log2(i)).
+ * Segments are allocated by the first id that needs them. Lookups are two loads.
+ * The id of a removed user is cleared and never handed out again, so once
+ * UINT32_MAX was handed out the table is full and nextId() only gives NO_ID.
+ */
+class UserIdTable
+{
+    public:
+
+        static const uint32_t NO_ID = 0;
+
+        UserIdTable();
+        ~UserIdTable();
+
+        UserIdTable(const UserIdTable&) = delete;
+        UserIdTable& operator=(const UserIdTable&) = delete;
+
+        uint32_t nextId();
+        void publish(UserNode* node);
+        void clear(uint32_t id);
+        UserNode* find(uint32_t id) const;
+
+        size_t memoryUsage() const;
+
+    private:
+
+        static const size_t SEGMENT_COUNT = 32; // Segment i holds ids 2^i to 2^(i+1) - 1
+
+        static size_t segmentOf(uint32_t id)
+        {
+            return 31 - __builtin_clz(id);
+        }
+
+        std::atomic<UserNode*>* segment(size_t index);
+
+        std::atomic<std::atomic<UserNode*>*> mSegments[SEGMENT_COUNT];
+        std::atomic<uint32_t> mNextId;
+};
+
+#endif
@@ -1,53 +1,51 @@
+#include <chrono>
 #include <iostream>
 #include "UserNode.hpp"
 #include "ChatServerGlobal.h"
 
+/** Read the clock the activity of the users is measured with
+ * @return int64_t: steady clock milliseconds
+ */
+int64_t UserNode::nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 /** Node Constructor **/
-UserNode::UserNode(std::string name): name_(name),
-                                      online_(true){}
+UserNode::UserNode(std::string name, uint32_t id, const MailboxPolicy& mailbox): online_(false),
+                                                                               name_(name),
+                                                                               mId(id),
+                                                                               mOnlineSlot(0),
+                                                                               mPresenceVersion(0),
+                                                                               mEvicted(false),
+                                                                               mSenders(0),
+                                                                               mLastActive(nowMs()),
+                                                                               mMailbox(mailbox){}
 
 /** Accessor method for name
- * @return string: name_ member
+ * @return const std::string&: name_ member, never changes
  */
-std::string UserNode::getName() const
+const std::string& UserNode::getName() const
 {
     return name_;
 }
 
-/** Get messages
- * @return messages sent to user
+/** Accessor method for id
+ * @return uint32_t: id handed out when the user first logged in
  */
-std::pair<UserNode::QUEUE_STATE, std::string> UserNode::getMessage()
+uint32_t UserNode::getId() const
 {
-    std::string message;
-    // Return state of message queue and read message
-    std::pair<UserNode::QUEUE_STATE, std::string> pair;
-
-    // If queue empty
-    if(!messages_.size())
-    {
-        message = RECEIVE_MESSAGE_EMPTY;
-        pair.first = UserNode::QUEUE_STATE::EMPTY;
-    }
-    // If queue not empty
-    else
-    {
-        // Dequeue single message
-        message = messages_.front();
-        messages_.pop();
-        pair.first = UserNode::QUEUE_STATE::NON_EMPTY;
-    }
-
-    pair.second = message;
-    return pair;
+    return mId;
 }
 
-/** Mutator method for online status
- * @param bool online: true if online, false if offline
+/** Take the oldest messages sent to the user at once
+ * @param std::vector<std::string>& messages: replaced by the messages, oldest first
+ * @param size_t max: most messages to take
+ * @return size_t: number of messages taken, 0 if there is none
  */
-void UserNode::setOnline(bool online)
+size_t UserNode::getMessages(std::vector<std::string>& messages, size_t max)
 {
-    online_ = online;
+    return mMailbox.drain(messages, max);
 }
 
 /** Accessor method for online status
@@ -58,11 +56,115 @@ bool UserNode::getOnline() const
     return online_;
 }
 
-/** Add a message to the message queue
- * @param std::string message: message to add
+/** Add a message to the mailbox
+ * @param std::initializer_list<std::string_view> message: pieces of the message, copied one after the other
+ * @return Mailbox::Result: QUEUED, or what the overflow policy did
+ */
+Mailbox::Result UserNode::addMessage(std::initializer_list<std::string_view> message)
+{
+    Mailbox::Result result = mMailbox.push(message);
+    // A subscriber takes the message right away, or once its stream can take more
+    if(std::shared_ptr<MailboxSubscriber> subscriber = mSubscriber.load(std::memory_order_acquire))
+        subscriber->notify();
+    return result;
+}
+
+/** Accessor for the number of messages waiting to be received
+ * @return size_t: number of queued messages, approximate while messages are sent
+ */
+size_t UserNode::getMessageCount() const
+{
+    return mMailbox.size();
+}
+
+/** Accessor for the mailbox, for its counters
+ * @return const Mailbox&: the mailbox
+ */
+const Mailbox& UserNode::getMailbox() const
+{
+    return mMailbox;
+}
+
+/** Mark the user active now, eviction counts its idle time from here
+ */
+void UserNode::touch()
+{
+    mLastActive.store(nowMs(), std::memory_order_relaxed);
+}
+
+/** Accessor for the time of the last activity
+ * @return int64_t: steady clock milliseconds of the last login, logout or message
+ */
+int64_t UserNode::getLastActive() const
+{
+    return mLastActive.load(std::memory_order_relaxed);
+}
+
+/** Announce a message about to be added, which keeps the user from being evicted until endSend()
+ * @return bool: false if the user is being evicted, look it up again
+ */
+bool UserNode::beginSend()
+{
+    // Either the evictor sees the sender in canReclaim(), or the sender sees the flag here
+    mSenders.fetch_add(1, std::memory_order_seq_cst);
+    if(!mEvicted.load(std::memory_order_seq_cst))
+        return true;
+
+    mSenders.fetch_sub(1, std::memory_order_release);
+    return false;
+}
+
+/** The message announced by beginSend() is in the mailbox
+ */
+void UserNode::endSend()
+{
+    mSenders.fetch_sub(1, std::memory_order_release);
+}
+
+/** Accessor for the eviction flag
+ * @return bool: true while the user is being evicted, or once it is
+ */
+bool UserNode::isEvicted() const
+{
+    return mEvicted.load(std::memory_order_acquire);
+}
+
+/** Check that nothing is left to lose, called once the user is marked evicted
+ * @return bool: true if no message is queued or being added, and no stream is subscribed
+ */
+bool UserNode::canReclaim() const
+{
+    return mSenders.load(std::memory_order_seq_cst) == 0 && mMailbox.size() == 0 && !hasSubscriber();
+}
+
+/** Push the mailbox to a stream from now on, in place of the current subscriber
+ * which is closed and notified so that it finishes
+ * @param std::shared_ptr<MailboxSubscriber> subscriber: the stream
+ */
+void UserNode::subscribe(std::shared_ptr<MailboxSubscriber> subscriber)
+{
+    std::shared_ptr<MailboxSubscriber> replaced = mSubscriber.exchange(std::move(subscriber), std::memory_order_seq_cst);
+    if(replaced)
+    {
+        replaced->close();
+        replaced->notify();
+    }
+}
+
+/** Stop pushing the mailbox to a stream, unless another one replaced it already
+ * @param const MailboxSubscriber* subscriber: the stream
  */
-void UserNode::addMessage(std::string message)
+void UserNode::unsubscribe(const MailboxSubscriber* subscriber)
 {
-    messages_.push(message);
+    std::shared_ptr<MailboxSubscriber> current = mSubscriber.load(std::memory_order_acquire);
+    if(current.get() == subscriber)
+        mSubscriber.compare_exchange_strong(current, nullptr, std::memory_order_acq_rel);
 }
 
+/** Check whether a stream is subscribed to the mailbox
+ * @return bool: true if there is a subscriber
+ */
+bool UserNode::hasSubscriber() const
+{
+    return mSubscriber.load(std::memory_order_seq_cst) != nullptr;
+}
@@ -1,28 +1,61 @@
 #ifndef NODE_H
 #define NODE_H
 
-#include <string>
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
 #include <iostream>
-#include <queue>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Mailbox.hpp"
 
 
+/** A user and its mailbox. Every method can be called from any thread. The
+ * user starts offline, the PresenceIndex sets it online and back. An offline
+ * user left idle can be evicted, senders then have to look it up again, and
+ * one that is being sent to or has a subscriber can't be. The subscriber, a
+ * ReceiveMessage stream, is notified of every message added.
+ */
 class UserNode
 {
     public:
-    
-        enum class QUEUE_STATE {EMPTY, NON_EMPTY};
-        UserNode(std::string name);
-        std::string getName() const;
+
+        UserNode(std::string name, uint32_t id, const MailboxPolicy& mailbox);
+        const std::string& getName() const;
+        uint32_t getId() const;
         bool getOnline() const;
-        void setOnline(bool online);
-        std::pair<UserNode::QUEUE_STATE, std::string> getMessage();
-        void addMessage(std::string message);
+        size_t getMessages(std::vector<std::string>& messages, size_t max);
+        Mailbox::Result addMessage(std::initializer_list<std::string_view> message);
+        size_t getMessageCount() const;
+        const Mailbox& getMailbox() const;
+        void touch();
+        int64_t getLastActive() const;
+        bool beginSend();
+        void endSend();
+        bool isEvicted() const;
+        bool canReclaim() const;
+        void subscribe(std::shared_ptr<MailboxSubscriber> subscriber);
+        void unsubscribe(const MailboxSubscriber* subscriber);
+        bool hasSubscriber() const;
+
+        static int64_t nowMs();
 
 
     private:
-        bool online_;
+        friend class PresenceIndex;
+
+        std::atomic<bool> online_; // Written by the PresenceIndex under its lock, read by anyone
     	std::string name_;
-	    std::queue<std::string> messages_;
+        const uint32_t mId; // Index of the user in the UserIdTable, never 0
+        size_t mOnlineSlot; // Position in the PresenceIndex while online, guarded by its lock
+        uint64_t mPresenceVersion; // Version of the index the user last changed in, guarded by its lock
+        std::atomic<bool> mEvicted;        // Set by the PresenceIndex under its lock, the user is being removed
+        std::atomic<uint32_t> mSenders;    // Messages being added to the mailbox
+        std::atomic<int64_t> mLastActive;  // Steady clock milliseconds of the last login, logout or message
+        std::atomic<std::shared_ptr<MailboxSubscriber>> mSubscriber; // Stream the mailbox is pushed to, if any
+        Mailbox mMailbox;
 };
 
 #endif
@@ -0,0 +1,232 @@
+#include "WorkStealingExecutor.hpp"
+
+// Index of the executor worker running on this thread, -1 on other threads
+static thread_local int tWorkerIndex = -1;
+
+/** WorkStealingExecutor Constructor
+ * @param int workers: number of worker threads
+ */
+WorkStealingExecutor::WorkStealingExecutor(int workers): mNextWorker(0)
+                                                       , mPendingTasks(0)
+                                                       , mIdleWorkers(0)
+                                                       , mStopping(false)
+                                                       , mTasks(0)
+                                                       , mLocalPops(0)
+                                                       , mSteals(0)
+                                                       , mParks(0)
+{
+    for(int i = 0; i < workers; i++)
+        mWorkers.push_back(std::unique_ptr<Worker>(new Worker()));
+}
+
+/** WorkStealingExecutor Destructor, stops the workers if still running
+ */
+WorkStealingExecutor::~WorkStealingExecutor()
+{
+    stop();
+}
+
+/** Start the worker threads, pinned to the given cpus if any
+ * @param const std::vector<int>& cpus: cpu of each worker, empty to let them float
+ */
+void WorkStealingExecutor::start(const std::vector<int>& cpus)
+{
+    for(size_t i = 0; i < mWorkers.size(); i++)
+    {
+        int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        // Nothing is queued yet, rebuild the worker's deque on the node it runs on
+        if(cpu >= 0)
+            runOnCpu(cpu, [this, i]{ mWorkers[i].reset(new Worker()); });
+        mThreads.emplace_back(&WorkStealingExecutor::run, this, (int)i, cpu);
+    }
+}
+
+/** Let the workers finish the pending tasks and wait for them to exit. Tasks
+ * must not be submitted from outside the workers once this is called.
+ */
+void WorkStealingExecutor::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mIdleMutex);
+        mStopping.store(true, std::memory_order_seq_cst);
+    }
+    mIdleCondition.notify_all();
+
+    for(auto& thread : mThreads)
+    {
+        if(thread.joinable())
+            thread.join();
+    }
+}
+
+/** Queue a task to be run on a worker, can be called from any thread
+ * @param Task task: task to run
+ */
+void WorkStealingExecutor::submit(Task task)
+{
+    int index = tWorkerIndex;
+    if(index < 0)
+        index = mNextWorker.fetch_add(1, std::memory_order_relaxed) % mWorkers.size();
+
+    Worker& worker = *mWorkers[index];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    taskQueued();
+}
+
+/** Queue a task behind the ones already queued, for a task giving its worker up
+ * to carry on later. From a worker it goes to the front of its own deque, which
+ * the worker takes last and the other workers steal first. From other threads
+ * it is the same as submit().
+ * @param Task task: task to run
+ */
+void WorkStealingExecutor::yield(Task task)
+{
+    int index = tWorkerIndex;
+    if(index < 0)
+    {
+        submit(std::move(task));
+        return;
+    }
+
+    Worker& worker = *mWorkers[index];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_front(std::move(task));
+    }
+    taskQueued();
+}
+
+/** Count a task just queued and wake a worker up if one is parked
+ */
+void WorkStealingExecutor::taskQueued()
+{
+    // Pairs with park(): either we see the idle worker, or it sees our task
+    mPendingTasks.fetch_add(1, std::memory_order_seq_cst);
+    if(mIdleWorkers.load(std::memory_order_seq_cst) > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mIdleMutex);
+        }
+        mIdleCondition.notify_one();
+    }
+}
+
+/** Accessor method for the number of workers
+ * @return int: number of worker threads
+ */
+int WorkStealingExecutor::workers() const
+{
+    return (int)mWorkers.size();
+}
+
+/** Take a task, newest from our own deque first, otherwise the oldest of another
+ * worker. Yielded tasks sit at the old end, so a worker only takes its own back
+ * once the tasks submitted to it are done, and the others steal them first.
+ * @param int index: worker looking for a task
+ * @param Task& task: where to store the task
+ * @return bool: true if a task was found
+ */
+bool WorkStealingExecutor::tryGetTask(int index, Task& task)
+{
+    Worker& own = *mWorkers[index];
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            mLocalPops.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    for(size_t i = 1; i < mWorkers.size(); i++)
+    {
+        Worker& victim = *mWorkers[(index + i) % mWorkers.size()];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if(lock.owns_lock() && !victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            mSteals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Sleep until some task is submitted or the executor stops
+ */
+void WorkStealingExecutor::park()
+{
+    std::unique_lock<std::mutex> lock(mIdleMutex);
+    mIdleWorkers.fetch_add(1, std::memory_order_seq_cst);
+    mParks.fetch_add(1, std::memory_order_relaxed);
+    mIdleCondition.wait(lock, [this]{ return mPendingTasks.load(std::memory_order_seq_cst) > 0
+                                          || mStopping.load(std::memory_order_seq_cst); });
+    mIdleWorkers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/** Worker loop until stopped, should be run in separate thread
+ * @param int index: index of this worker
+ * @param int cpu: cpu to pin the worker to, -1 to let it float
+ */
+void WorkStealingExecutor::run(int index, int cpu)
+{
+    tWorkerIndex = index;
+    if(cpu >= 0)
+        pinCurrentThread(cpu);
+
+    Task task;
+    while(true)
+    {
+        if(!tryGetTask(index, task))
+        {
+            // A try_lock may have skipped a busy deque, only sleep if nothing is pending at all
+            if(mPendingTasks.load(std::memory_order_seq_cst) == 0)
+            {
+                if(mStopping.load(std::memory_order_seq_cst))
+                    return;
+                park();
+            }
+            else
+                std::this_thread::yield();
+            continue;
+        }
+
+        mPendingTasks.fetch_sub(1, std::memory_order_relaxed);
+        mTasks.fetch_add(1, std::memory_order_relaxed);
+        task();
+        task = nullptr;
+    }
+}
+
+/** Accessor for the executor counters
+ * @return Stats: snapshot of the counters
+ */
+WorkStealingExecutor::Stats WorkStealingExecutor::getStats() const
+{
+    Stats stats;
+    stats.tasks = mTasks.load(std::memory_order_relaxed);
+    stats.localPops = mLocalPops.load(std::memory_order_relaxed);
+    stats.steals = mSteals.load(std::memory_order_relaxed);
+    stats.parks = mParks.load(std::memory_order_relaxed);
+    return stats;
+}
+
+/** Print executor counters
+ * @param std::ostream& out: stream to print to
+ * @param const Stats& stats: counters to print
+ * @return std::ostream&: the stream printed to
+ */
+std::ostream& operator<<(std::ostream& out, const WorkStealingExecutor::Stats& stats)
+{
+    out << "tasks=" << stats.tasks
+        << " localPops=" << stats.localPops
+        << " steals=" << stats.steals
+        << " parks=" << stats.parks;
+    return out;
+}
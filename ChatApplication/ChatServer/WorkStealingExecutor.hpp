@@ -0,0 +1,82 @@
+#ifndef WORK_STEALING_EXECUTOR_H
+#define WORK_STEALING_EXECUTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CpuTopology.hpp"
+#include "MpscQueue.hpp"
+
+/** Thread pool where every worker has its own deque of tasks. A worker takes
+ * its newest task first, which keeps its caches warm, and when it runs out it
+ * steals the oldest task of another worker. Idle workers park on a condition
+ * variable. Tasks submitted from a worker go to its own deque, tasks submitted
+ * from other threads are spread over the workers round-robin. A task that gives
+ * its worker up to come back later is yielded instead: it goes to the old end of
+ * the deque, so it runs after the tasks queued already, or is stolen first.
+ */
+class WorkStealingExecutor
+{
+    public:
+
+        using Task = std::function<void()>;
+
+        // Counters used to see how well the load is spread
+        struct Stats
+        {
+            uint64_t tasks;     // Tasks run
+            uint64_t localPops; // Tasks taken from the worker's own deque
+            uint64_t steals;    // Tasks taken from another worker's deque
+            uint64_t parks;     // Times a worker found nothing to do and parked
+        };
+
+        explicit WorkStealingExecutor(int workers);
+        ~WorkStealingExecutor();
+
+        void start(const std::vector<int>& cpus = std::vector<int>());
+        void stop();
+        void submit(Task task);
+        void yield(Task task);
+        int workers() const;
+        Stats getStats() const;
+
+    private:
+
+        struct alignas(CACHE_LINE_SIZE) Worker
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void run(int index, int cpu);
+        void taskQueued();
+        bool tryGetTask(int index, Task& task);
+        void park();
+
+        std::vector<std::unique_ptr<Worker>> mWorkers;
+        std::vector<std::thread> mThreads;
+        std::atomic<uint32_t> mNextWorker;
+
+        // Tasks submitted and not yet taken, lets a parking worker know whether it may sleep
+        std::atomic<int64_t> mPendingTasks;
+        std::atomic<int> mIdleWorkers;
+        std::atomic<bool> mStopping; // Workers return once no task is pending
+        std::mutex mIdleMutex;
+        std::condition_variable mIdleCondition;
+
+        std::atomic<uint64_t> mTasks;
+        std::atomic<uint64_t> mLocalPops;
+        std::atomic<uint64_t> mSteals;
+        std::atomic<uint64_t> mParks;
+};
+
+std::ostream& operator<<(std::ostream& out, const WorkStealingExecutor::Stats& stats);
+
+#endif